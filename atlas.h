@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "raylib.h"
+#include "profiler.h"
+
+namespace Engine {
+    // Packs images into shared texture pages with a skyline (bottom-left) packer, so sprites from
+    // different images can be drawn without switching textures. Entries keep their id across Repack().
+    // The atlas must outlive the ImageTextures packed into it, their image's entry is removed when the last one goes.
+    class TextureAtlas {
+        private:
+            struct Node {
+                int x;
+                int y;
+                int width;
+            };
+            struct Page {
+                int width;
+                int height;
+                Image image;
+                Texture2D texture;
+                bool texture_loaded=false;
+                std::vector<Node> skyline;
+            };
+            struct Entry {
+                // Owned RGBA copy, kept so the entry can be moved by Repack
+                Image image;
+                int page=-1;
+                Rectangle rect;
+                bool live=false;
+            };
+            std::vector<Page> pages;
+            std::vector<Entry> entries;
+            std::vector<int> free_entries;
+
+            // Lowest y the rectangle can sit at starting from skyline node i, or -1 if it doesn't fit
+            static int FitAt(const Page& p, int i, int width, int height) {
+                int x=p.skyline[i].x;
+                if(x+width>p.width) return -1;
+                int y=0;
+                for(int left=width; left>0; i++) {
+                    if(i==int(p.skyline.size())) return -1;
+                    y=std::max(y, p.skyline[i].y);
+                    if(y+height>p.height) return -1;
+                    left-=p.skyline[i].width;
+                }
+                return y;
+            }
+            static bool Place(Page& p, int width, int height, int& out_x, int& out_y) {
+                int best=-1;
+                int best_y=INT_MAX;
+                int best_width=INT_MAX;
+                for(int i=0; i<int(p.skyline.size()); i++) {
+                    int y=FitAt(p, i, width, height);
+                    if(y<0) continue;
+                    if(y+height<best_y || (y+height==best_y && p.skyline[i].width<best_width)) {
+                        best=i;
+                        best_y=y+height;
+                        best_width=p.skyline[i].width;
+                    }
+                }
+                if(best<0) return false;
+                out_x=p.skyline[best].x;
+                out_y=best_y-height;
+                p.skyline.insert(p.skyline.begin()+best, Node{out_x, best_y, width});
+                // Trim the nodes now covered by the new one, then merge neighbours at the same height
+                for(int i=best+1; i<int(p.skyline.size()); i++) {
+                    Node& prev=p.skyline[i-1];
+                    Node& n=p.skyline[i];
+                    int overlap=prev.x+prev.width-n.x;
+                    if(overlap<=0) break;
+                    n.x+=overlap;
+                    n.width-=overlap;
+                    if(n.width>0) break;
+                    p.skyline.erase(p.skyline.begin()+i);
+                    i--;
+                }
+                for(int i=0; i+1<int(p.skyline.size()); i++) {
+                    if(p.skyline[i].y==p.skyline[i+1].y) {
+                        p.skyline[i].width+=p.skyline[i+1].width;
+                        p.skyline.erase(p.skyline.begin()+i+1);
+                        i--;
+                    }
+                }
+                return true;
+            }
+            void AddPage(int width, int height) {
+                Page p;
+                p.width=width;
+                p.height=height;
+                p.image=GenImageColor(width, height, BLANK);
+                p.skyline.push_back(Node{0, 0, width});
+                pages.push_back(p);
+            }
+            Entry& Live(int id) {
+                if(id<0 || id>=int(entries.size()) || !entries[id].live)
+                    throw std::out_of_range("No live atlas entry "+std::to_string(id));
+                return entries[id];
+            }
+            const Entry& Live(int id)const{
+                return const_cast<TextureAtlas*>(this)->Live(id);
+            }
+            void Pack(int id) {
+                Entry& e=entries[id];
+                int width=e.image.width+padding;
+                int height=e.image.height+padding;
+                int x, y;
+                int page=-1;
+                for(int i=0; i<int(pages.size()); i++) {
+                    if(Place(pages[i], width, height, x, y)) {
+                        page=i;
+                        break;
+                    }
+                }
+                if(page<0) {
+                    // Oversized images get a page of their own
+                    AddPage(std::max(page_size, width), std::max(page_size, height));
+                    page=pages.size()-1;
+                    Place(pages[page], width, height, x, y);
+                }
+                Page& p=pages[page];
+                e.page=page;
+                e.rect=Rectangle{float(x), float(y), float(e.image.width), float(e.image.height)};
+                ImageDraw(&p.image, e.image, Rectangle{0, 0, e.rect.width, e.rect.height}, e.rect, WHITE);
+                if(p.texture_loaded)
+                    UpdateTextureRec(p.texture, e.rect, e.image.data);
+            }
+        public:
+            int page_size;
+            // Transparent pixels left between entries so filtering doesn't bleed neighbours in
+            int padding;
+            TextureAtlas(int page_size=2048, int padding=1) : page_size(page_size), padding(padding) {}
+            TextureAtlas(const TextureAtlas&)=delete;
+            ~TextureAtlas() {
+                Unload();
+                for(auto& e : entries) {
+                    if(e.live) UnloadImage(e.image);
+                }
+            }
+            // Copies img into the atlas and returns its entry id. Pages already on the GPU are updated in place.
+            int Insert(Image img) {
+                PROFILE_SCOPE("Atlas Insert");
+                int id;
+                if(!free_entries.empty()) {
+                    id=free_entries.back();
+                    free_entries.pop_back();
+                } else {
+                    id=entries.size();
+                    entries.emplace_back();
+                }
+                Entry& e=entries[id];
+                e.image=ImageCopy(img);
+                ImageFormat(&e.image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+                e.live=true;
+                Pack(id);
+                return id;
+            }
+            // The entry's space is only reclaimed by the next Repack, its id may be handed out by the next Insert
+            void Remove(int id) {
+                if(id<0 || id>=int(entries.size())) return;
+                Entry& e=entries[id];
+                if(!e.live) return;
+                UnloadImage(e.image);
+                e.live=false;
+                e.page=-1;
+                free_entries.push_back(id);
+            }
+            // Packs every live entry again from scratch, tallest first, which usually needs fewer pages than
+            // incremental insertion did. Page textures are reloaded on next use, don't call it mid frame.
+            void Repack() {
+                PROFILE_SCOPE("Atlas Repack");
+                Unload();
+                std::vector<int> order;
+                for(int i=0; i<int(entries.size()); i++) {
+                    if(entries[i].live) order.push_back(i);
+                }
+                std::sort(order.begin(), order.end(), [this](int a, int b) {
+                    if(entries[a].image.height!=entries[b].image.height)
+                        return entries[a].image.height>entries[b].image.height;
+                    return entries[a].image.width>entries[b].image.width;
+                });
+                for(auto i : order) {
+                    Pack(i);
+                }
+            }
+            // Both throw std::out_of_range for ids that were never inserted or were removed
+            Texture2D& GetTexture(int id) {
+                Page& p=pages[Live(id).page];
+                if(!p.texture_loaded) {
+                    p.texture=LoadTextureFromImage(p.image);
+                    p.texture_loaded=true;
+                }
+                return p.texture;
+            }
+            // Where the entry sits on its page, in pixels
+            Rectangle Source(int id)const{
+                return Live(id).rect;
+            }
+            int PageCount()const{
+                return pages.size();
+            }
+            // Drops the pages (not the entries), Repack builds them again
+            void Unload() {
+                for(auto& p : pages) {
+                    if(p.texture_loaded) UnloadTexture(p.texture);
+                    UnloadImage(p.image);
+                }
+                pages.clear();
+            }
+    };
+}
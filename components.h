@@ -0,0 +1,167 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace Engine {
+    class Object;
+    // Types get small sequential ids per family the first time they're used, e.g. objects index their components by it
+    template<typename Family> struct TypeCounter{
+        static std::atomic<int> count;
+        TypeCounter()=delete;
+    };
+    template<typename Family> std::atomic<int> TypeCounter<Family>::count{0};
+    template<typename Family, typename T> int FamilyTypeID() {
+        static const int id=TypeCounter<Family>::count++;
+        return id;
+    }
+    class Component;
+    template<typename T> int ComponentTypeID() {
+        return FamilyTypeID<Component, T>();
+    }
+
+    // Components opt into dense storage with `static constexpr bool dense_storage=true;`
+    // their UpdateComponent then runs from the pool's system loop instead of through the owning object
+    template<typename T, typename=void> struct IsDenseComponent : std::false_type {};
+    template<typename T> struct IsDenseComponent<T, std::enable_if_t<T::dense_storage>> : std::true_type {};
+
+    // Components list the base classes GetComponent should find them (and their subclasses) through with
+    // `using findable_as=std::tuple<Base, ...>;`, their ids are filed along with the component's own one
+    template<typename T, typename=void> struct FindableAs{
+        static std::vector<int> IDs() {
+            return {};
+        }
+    };
+    template<typename T> struct FindableAs<T, std::void_t<typename T::findable_as>>{
+        template<typename... Bases> static std::vector<int> Collect(std::tuple<Bases...>*) {
+            static_assert((std::is_base_of<Bases, T>::value && ...), "findable_as must list base classes of the component");
+            std::vector<int> ids;
+            for(int id : {ComponentTypeID<Bases>()...}) {
+                if(id!=ComponentTypeID<T>()) ids.push_back(id);
+            }
+            return ids;
+        }
+        static std::vector<int> IDs() {
+            return Collect(static_cast<typename T::findable_as*>(nullptr));
+        }
+    };
+    template<typename T> const std::vector<int>* ComponentBaseIDs() {
+        static const std::vector<int> ids=FindableAs<T>::IDs();
+        return &ids;
+    }
+
+    class PoolBase {
+        public:
+            virtual ~PoolBase() {}
+            virtual void Destroy(int slot)=0;
+            virtual void Reset()=0;
+            virtual void UpdateSystem() {}
+    };
+    // Keeps every instance of type T in fixed size chunks with a free list. Addresses never move, so the
+    // pointers in Scene::objects, Object::components and Box2D user data stay valid, and loops walk memory in order.
+    template<typename T> class Pool : public PoolBase {
+        private:
+            static constexpr int chunk_size=256;
+            struct Chunk {
+                alignas(T) unsigned char storage[sizeof(T)*chunk_size];
+                Object* owners[chunk_size]={};
+                bool live[chunk_size]={};
+                T* At(int i) {
+                    return std::launder(reinterpret_cast<T*>(storage)+i);
+                }
+            };
+            std::vector<std::unique_ptr<Chunk>> chunks;
+            std::vector<int> free_slots;
+            int used=0;
+            int alive=0;
+        public:
+            Pool()=default;
+            Pool(const Pool&)=delete;
+            ~Pool() {
+                Reset();
+            }
+            T* Create(Object* owner, int& slot) {
+                if(!free_slots.empty()) {
+                    slot=free_slots.back();
+                    free_slots.pop_back();
+                } else {
+                    slot=used++;
+                    if(slot/chunk_size==chunks.size()) chunks.emplace_back(new Chunk);
+                }
+                Chunk& c=*chunks[slot/chunk_size];
+                T* t=new(c.At(slot%chunk_size)) T;
+                c.owners[slot%chunk_size]=owner;
+                c.live[slot%chunk_size]=true;
+                alive++;
+                return t;
+            }
+            void SetOwner(int slot, Object* owner) {
+                chunks[slot/chunk_size]->owners[slot%chunk_size]=owner;
+            }
+            void Destroy(int slot)override{
+                Chunk& c=*chunks[slot/chunk_size];
+                if(!c.live[slot%chunk_size]) return;
+                c.At(slot%chunk_size)->~T();
+                c.owners[slot%chunk_size]=nullptr;
+                c.live[slot%chunk_size]=false;
+                free_slots.push_back(slot);
+                alive--;
+            }
+            // Destroys everything at once and hands the chunks back
+            void Reset()override{
+                ForEach([](T& t, Object* owner) { t.~T(); });
+                chunks.clear();
+                free_slots.clear();
+                used=0;
+                alive=0;
+            }
+            int Size()const{
+                return alive;
+            }
+            // fn(T& element, Object* owner) for every live element, in memory order
+            template<typename F> void ForEach(F fn) {
+                for(int slot=0; slot<used; slot++) {
+                    Chunk& c=*chunks[slot/chunk_size];
+                    if(c.live[slot%chunk_size])
+                        fn(*c.At(slot%chunk_size), c.owners[slot%chunk_size]);
+                }
+            }
+            void UpdateSystem()override{
+                if constexpr(IsDenseComponent<T>::value) {
+                    // Qualified call, every element is exactly a T so there's no need for virtual dispatch
+                    ForEach([](T& component, Object* owner) { component.T::UpdateComponent(owner); });
+                }
+            }
+    };
+    // One pool per concrete object or component type, owned by a Scene
+    class PoolSet {
+        private:
+            std::vector<std::unique_ptr<PoolBase>> pools;
+        public:
+            // Set by Scene::AddObject<T> while T is constructed so Object's constructor can pick it up
+            static thread_local PoolSet* constructing;
+            PoolSet()=default;
+            PoolSet(const PoolSet&)=delete;
+            template<typename T> Pool<T>& Get() {
+                int id=FamilyTypeID<PoolSet, T>();
+                if(id>=pools.size()) pools.resize(id+1);
+                if(pools[id]==nullptr) pools[id].reset(new Pool<T>);
+                return static_cast<Pool<T>&>(*pools[id]);
+            }
+            void UpdateSystems() {
+                for(auto& i : pools) {
+                    if(i!=nullptr) i->UpdateSystem();
+                }
+            }
+            void Reset() {
+                for(auto& i : pools) {
+                    if(i!=nullptr) i->Reset();
+                }
+            }
+    };
+    thread_local PoolSet* PoolSet::constructing=nullptr;
+}
@@ -1,38 +1,37 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include "include/collision.h"
 #include "include/id.h"
 #include "include/math_functions.h"
 #include "raylib.h"
 #include "keybinds.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "stats.h"
+#include "render.h"
+#include "atlas.h"
+#include "textures.h"
+#include "components.h"
 #include "include/box2d.h"
 #include "include/base.h"
 #include "include/types.h"
 #include "include/math_functions.h"
-#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace Engine{
-    struct ProfileTimer{
-        std::chrono::time_point<std::chrono::high_resolution_clock> start,end;
-        const char* name;
-        ProfileTimer(const char* name) : name(name) {
-            start=std::chrono::high_resolution_clock::now();
-        }
-        ~ProfileTimer() {
-            end=std::chrono::high_resolution_clock::now();
-            auto duration=end.time_since_epoch()-start.time_since_epoch();
-            auto t_duration = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 1000.0f;
-            auto s_duration = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() / 1000.0f;
-            std::cout<<"\033[1;106;30m"<<name<<": "<<t_duration<<"ms"<<" ("<<s_duration<<"s)\033[0m"<<std::endl;
-        }
-    };
     class CircularNumber{
         private:
             double range=360;
@@ -133,6 +132,12 @@ namespace Engine{
         Vec2 operator+(const Vec2 &v) const{
             return Vec2(x+v.x,y+v.y);
         }
+        bool operator==(const Vec2 &v) const{
+            return x==v.x && y==v.y;
+        }
+        bool operator!=(const Vec2 &v) const{
+            return !(*this==v);
+        }
         Vec2 operator-(const Vec2 &v) const{
             return Vec2(x-v.x,y-v.y);
         }
@@ -186,77 +191,453 @@ namespace Engine{
             return b2Vec2{float(x),float(y)};
         }
     };
-    std::vector<const char*> signals;
+    struct Time{
+        static bool fixed_step;
+        static float tick_rate;
+        static int max_steps;
+        static float max_frame_time;
+        static int substeps;
+        static float accumulator;
+        static float alpha;
+        static uint64_t steps;
+        Time()=delete;
+    };
+    bool Time::fixed_step=false;
+    float Time::tick_rate=60;
+    int Time::max_steps=5;
+    float Time::max_frame_time=0.25f;
+    int Time::substeps=4;
+    float Time::accumulator=0;
+    float Time::alpha=1;
+    uint64_t Time::steps=0;
+    typedef uint32_t SignalID;
+    class Object;
+    // Signal names are interned once, emitting and dispatching only deal with integer ids
+    struct Signals{
+        static std::unordered_map<std::string, SignalID> ids;
+        static std::vector<std::string> names;
+        static std::vector<std::vector<Object*>> subscribers;
+        static std::vector<SignalID> pending;
+        static std::vector<SignalID> dispatching;
+        // Copy of the subscriber list being delivered to, receivers may change the real one
+        static std::vector<Object*> receivers;
+        static SignalID Register(const std::string& name) {
+            auto it=ids.find(name);
+            if(it!=ids.end()) return it->second;
+            SignalID id=names.size();
+            ids.emplace(name, id);
+            names.push_back(name);
+            subscribers.emplace_back();
+            return id;
+        }
+        static const std::string& Name(SignalID id) {
+            return names[id];
+        }
+        Signals()=delete;
+    };
+    std::unordered_map<std::string, SignalID> Signals::ids;
+    std::vector<std::string> Signals::names;
+    std::vector<std::vector<Object*>> Signals::subscribers;
+    std::vector<SignalID> Signals::pending;
+    std::vector<SignalID> Signals::dispatching;
+    std::vector<Object*> Signals::receivers;
+    // Named bits for Object tag masks, up to 64 of them
+    struct Tags{
+        static std::unordered_map<std::string, uint64_t> bits;
+        static uint64_t Register(const std::string& name) {
+            auto it=bits.find(name);
+            if(it!=bits.end()) return it->second;
+            if(bits.size()>=64) throw std::length_error("Only 64 tags can be registered");
+            uint64_t bit=uint64_t(1)<<bits.size();
+            bits.emplace(name, bit);
+            return bit;
+        }
+        Tags()=delete;
+    };
+    std::unordered_map<std::string, uint64_t> Tags::bits;
+    // Generational reference to an object in a Scene, stays safe to hold after the object is gone
+    struct Handle{
+        uint32_t index=UINT32_MAX;
+        uint32_t generation=0;
+        bool operator==(const Handle& h)const{
+            return index==h.index && generation==h.generation;
+        }
+        bool operator!=(const Handle& h)const{
+            return !(*this==h);
+        }
+    };
     class Component;
+    struct Scene;
     class Object {
         private:
+            // World transform as of the last hierarchy pass, used to notice that it was written directly
             Vec2 position_old=Vec2(0,0);
+            double rotation_old=0;
+            Vec2 scale_old=Vec2(1,1);
+            uint64_t tags=0;
         public:
             bool visible=true;
+            // Draw order: every layer draws over the lower ones, within a layer higher depth draws on top
+            uint8_t layer=0;
+            int16_t depth=0;
+            // Update() may run on a worker thread in parallel with other thread safe objects.
+            // It must only write this object's own fields: no EmitSignal, Box2D calls, raylib calls or resolving other
+            // objects' handles. Structural changes go through the scene's deferred Spawn/Destroy/Defer* calls.
+            bool thread_safe=false;
             Vec2 position;
             CircularNumber rotation=CircularNumber(0);
             Vec2 size=Vec2(1,1);
             Vec2 scale=Vec2(1,1);
-            std::vector<Object*> children;
+            Handle handle;
+            // Scene the object was added to, set when it gets its handle
+            Scene* scene=nullptr;
+            // position, rotation and scale are world space. Children also keep a transform local to their
+            // parent, their world transform is rebuilt from it only when the parent or the local transform changes.
+            // Writing a child's world transform directly works too, it's turned back into a local transform
+            // relative to where the parent was at the last hierarchy pass.
+            Handle parent;
+            std::vector<Handle> children;
+            Vec2 local_position;
+            CircularNumber local_rotation=CircularNumber(0);
+            Vec2 local_scale=Vec2(1,1);
+            bool transform_dirty=false;
+            // In the scene's list of objects that have a parent or children
+            bool transform_node=false;
             std::vector<Component*> components;
+            // First component of each type and findable_as base, indexed by ComponentTypeID
+            std::vector<Component*> component_slots;
+            // Pools of the scene this object was allocated from, nullptr for objects created with new
+            PoolSet* pools;
+            PoolBase* pool=nullptr;
+            int pool_slot=-1;
+            Object() : pools(PoolSet::constructing) {
+                PoolSet::constructing=nullptr;
+            }
+            virtual ~Object() {}
             virtual void Start() {}
             virtual void Update(float DeltaTime) {}
             virtual void UpdateComponents();
             virtual void Draw() {}
-            void UpdateChildren() {
-                Vec2 change=position-position_old;
-                for(auto i : children) {
-                    i->position=i->position+change;
-                    i->UpdateChildren();
+            // Records what Draw() would render so the pipelined loop can draw it while the next frame simulates.
+            // Returns false if the object can only be drawn through Draw().
+            virtual bool Snapshot(std::vector<DrawItem>& items) {
+                return false;
+            }
+            // Without a parent the local transform is the world transform
+            void SetLocalPosition(Vec2 p) {
+                local_position=p;
+                if(parent.index==UINT32_MAX) position=p;
+                MarkTransformDirty();
+            }
+            void SetLocalRotation(double degrees) {
+                local_rotation=degrees;
+                if(parent.index==UINT32_MAX) rotation=degrees;
+                MarkTransformDirty();
+            }
+            void SetLocalScale(Vec2 s) {
+                local_scale=s;
+                if(parent.index==UINT32_MAX) scale=s;
+                MarkTransformDirty();
+            }
+            // Queues this object for the next hierarchy pass of its scene. Locks, so it's safe from parallel Update.
+            void MarkTransformDirty();
+            friend void UpdateTransforms(Scene& scene);
+            friend struct Scene;
+            // Constant time lookup of T or of a component whose findable_as lists T
+            template<typename T> T* GetComponent()const;
+            // Scans every component with dynamic_cast, for subclasses of T that don't list it in findable_as
+            template<typename T> T* FindComponent()const;
+            template<typename T> bool HasComponent()const{
+                return GetComponent<T>()!=nullptr;
+            }
+            template<typename T> std::vector<T*> GetComponents()const;
+            template<typename T> void AddComponent();
+            // Allocates a component from this object's pools without attaching it
+            template<typename T> T* CreateComponent();
+            void AttachComponent(Component* c);
+            // Returns false if c isn't attached to this object
+            bool DetachComponent(Component* c);
+            // Set once the object's Start() has run and its physics bodies exist
+            bool in_scene=false;
+            // Position in Scene::objects, -1 while not in it
+            int scene_index=-1;
+            // Which per-frame lists the scene keeps this object in. AddObject<T> clears the ones T doesn't
+            // override, set them to false yourself for objects added through AddObject(Object*).
+            bool ticks_update=true;
+            bool ticks_draw=true;
+            bool ticks_components=true;
+            // Drawn through Snapshot() instead of Draw(). AddObject<T> sets it when T's Snapshot() is at least as
+            // derived as its Draw(), so a subclass overriding only Draw() still gets it called. Objects added
+            // through AddObject(Object*) have to opt in themselves.
+            bool batchable=false;
+            int update_index=-1;
+            int draw_index=-1;
+            int component_index=-1;
+            // Opt in to leave the update lists while this object's body sleeps, it's still drawn
+            bool sleeps_with_body=false;
+            bool dormant=false;
+            // Position in each of the scene's per-tag lists, sized on the first tag
+            std::vector<int> tag_index;
+            uint64_t Tags()const{
+                return tags;
+            }
+            bool HasTags(uint64_t mask)const{
+                return (tags&mask)==mask;
+            }
+            void SetTags(uint64_t mask);
+            void AddTags(uint64_t mask) {
+                SetTags(tags|mask);
+            }
+            void RemoveTags(uint64_t mask) {
+                SetTags(tags&~mask);
+            }
+            // Drawn once into the scene's cached tiles instead of every frame. Set it before adding the object,
+            // and call InvalidateStatic() after moving or changing the object.
+            bool static_layer=false;
+            // Set while the object waits to be filed by the cache's next Update, and while it's in the cache
+            // with the box it was filed under
+            bool static_pending=false;
+            bool static_cached=false;
+            b2AABB static_box;
+            void InvalidateStatic();
+            // Proxy in the scene's culling tree and the enlarged box it was inserted with
+            int cull_proxy=-1;
+            b2AABB cull_box;
+            // Pose the bounds were last computed for, compared against every frame to notice moves
+            Vec2 bounds_position;
+            double bounds_rotation=0;
+            Vec2 bounds_size;
+            Vec2 bounds_scale;
+            // Position in the scene's lists of drawables whose bounds must be recomputed and drawables without bounds
+            int moved_index=-1;
+            int unculled_index=-1;
+            // Queues the object's bounds to be recomputed before the next cull. Changes to position, rotation, size
+            // and scale are noticed without it, call it after changing anything else WorldBounds() depends on.
+            void MarkMoved();
+            // World space box that contains everything Draw() renders. Objects returning false are never culled.
+            virtual bool WorldBounds(b2AABB& box) {
+                return false;
+            }
+            std::vector<SignalID> subscriptions;
+            void EmitSignal(SignalID signal) {
+                Signals::pending.push_back(signal);
+            }
+            void EmitSignal(const char* signal) {
+                EmitSignal(Signals::Register(signal));
+            }
+            // Only subscribed objects receive a signal
+            void Subscribe(SignalID signal) {
+                for(auto i : subscriptions) {
+                    if(i==signal) return;
                 }
+                subscriptions.push_back(signal);
+                Signals::subscribers[signal].push_back(this);
             }
-            template<typename T> T* GetComponent()const{
-                for(int i=0; i<components.size(); i++) {
-                    if(dynamic_cast<T*>(components[i]) != nullptr) {
-                        // static_assert(std::is_base_of<Component*, T*>::i, "Get Component failed");
-                        return dynamic_cast<T*>(components[i]);
+            void Subscribe(const char* signal) {
+                Subscribe(Signals::Register(signal));
+            }
+            void Unsubscribe(SignalID signal) {
+                for(int i=0; i<subscriptions.size(); i++) {
+                    if(subscriptions[i]!=signal) continue;
+                    subscriptions[i]=subscriptions.back();
+                    subscriptions.pop_back();
+                    auto& list=Signals::subscribers[signal];
+                    for(int j=0; j<list.size(); j++) {
+                        if(list[j]==this) {
+                            list[j]=list.back();
+                            list.pop_back();
+                            break;
+                        }
                     }
+                    return;
                 }
-                return nullptr;
             }
-            template<typename T> void AddComponent() {
-                components.emplace_back(new T);
+            void UnsubscribeAll() {
+                while(!subscriptions.empty()) {
+                    Unsubscribe(subscriptions.back());
+                }
             }
-            void EmitSignal(const char* signal) {
-                signals.push_back(signal);
+            virtual void RecieveSignal(SignalID signal) {
+                RecieveSignal(Signals::Name(signal));
             }
             virtual void RecieveSignal(std::string signal) {}
     };
     class Component {
         public:
+            // Set for dense components kept in a scene pool, their UpdateComponent runs from the pool's system loop
+            bool dense=false;
+            int type_id=-1;
+            // Ids of the findable_as bases, the component fills their slots too
+            const std::vector<int>* base_ids=nullptr;
+            bool HasTypeID(int id)const{
+                if(id==type_id) return true;
+                return base_ids!=nullptr && std::find(base_ids->begin(), base_ids->end(), id)!=base_ids->end();
+            }
+            PoolBase* pool=nullptr;
+            int pool_slot=-1;
+            virtual ~Component() {}
             virtual void Box2dSceneInit(b2WorldId b, Object* obj) {}
+            virtual void Box2dSceneDestroy(Object* obj) {}
             virtual void UpdateComponent(Object* obj) {}
     };
     inline void Object::UpdateComponents() {
         for(auto i : components) {
-            i->UpdateComponent(this);
+            if(!i->dense)
+                i->UpdateComponent(this);
         }
     }
+    template<typename T> T* Object::GetComponent()const{
+        static_assert(std::is_base_of<Component, T>::value, "GetComponent needs a Component type");
+        int id=ComponentTypeID<T>();
+        if(id<component_slots.size() && component_slots[id]!=nullptr)
+            return static_cast<T*>(component_slots[id]);
+        return nullptr;
+    }
+    template<typename T> T* Object::FindComponent()const{
+        if(T* t=GetComponent<T>()) return t;
+        for(auto i : components) {
+            if(T* t=dynamic_cast<T*>(i)) return t;
+        }
+        return nullptr;
+    }
+    template<typename T> std::vector<T*> Object::GetComponents()const{
+        static_assert(std::is_base_of<Component, T>::value, "GetComponents needs a Component type");
+        int id=ComponentTypeID<T>();
+        std::vector<T*> result;
+        for(auto i : components) {
+            if(i->HasTypeID(id))
+                result.push_back(static_cast<T*>(i));
+        }
+        return result;
+    }
+    template<typename T> T* Object::CreateComponent() {
+        T* t;
+        if(pools!=nullptr) {
+            Pool<T>& p=pools->Get<T>();
+            int slot;
+            t=p.Create(this, slot);
+            t->pool=&p;
+            t->pool_slot=slot;
+            t->dense=IsDenseComponent<T>::value;
+        } else {
+            t=new T;
+        }
+        t->type_id=ComponentTypeID<T>();
+        t->base_ids=ComponentBaseIDs<T>();
+        return t;
+    }
+    inline bool Object::DetachComponent(Component* c) {
+        auto it=std::find(components.begin(), components.end(), c);
+        if(it==components.end()) return false;
+        components.erase(it);
+        auto refill=[this, c](int id) {
+            if(id>=component_slots.size() || component_slots[id]!=c) return;
+            component_slots[id]=nullptr;
+            for(auto i : components) {
+                if(i->HasTypeID(id)) {
+                    component_slots[id]=i;
+                    break;
+                }
+            }
+        };
+        refill(c->type_id);
+        if(c->base_ids!=nullptr) {
+            for(int id : *c->base_ids) {
+                refill(id);
+            }
+        }
+        return true;
+    }
+    template<typename T> void Object::AddComponent() {
+        AttachComponent(CreateComponent<T>());
+    }
+    // Detects at compile time which per-frame hooks T overrides
+    template<typename M> struct MemberClass;
+    template<typename C, typename M> struct MemberClass<M C::*>{
+        using type=C;
+    };
+    template<typename T> struct ObjectHooks{
+        static constexpr bool update=!std::is_same<decltype(&T::Update), void (Object::*)(float)>::value;
+        static constexpr bool draw=!std::is_same<decltype(&T::Draw), void (Object::*)()>::value
+            || !std::is_same<decltype(&T::Snapshot), bool (Object::*)(std::vector<DrawItem>&)>::value;
+        static constexpr bool components=!std::is_same<decltype(&T::UpdateComponents), void (Object::*)()>::value;
+        // Snapshot() is overridden and no class below it overrides Draw() again
+        static constexpr bool snapshot=!std::is_same<typename MemberClass<decltype(&T::Snapshot)>::type, Object>::value
+            && std::is_base_of<typename MemberClass<decltype(&T::Draw)>::type,
+                typename MemberClass<decltype(&T::Snapshot)>::type>::value;
+    };
+    inline void FreeComponent(Component* c) {
+        if(c->pool!=nullptr)
+            c->pool->Destroy(c->pool_slot);
+        else
+            delete c;
+    }
+    inline void FreeObject(Object* obj) {
+        for(auto i : obj->components) {
+            FreeComponent(i);
+        }
+        if(obj->pool!=nullptr)
+            obj->pool->Destroy(obj->pool_slot);
+        else
+            delete obj;
+    }
     class DynamicBody : public Component {
         public:
-            b2BodyId bodyID;
-            void UpdateComponent(Object* obj)override {
-                b2Vec2 p = b2Body_GetWorldPoint(bodyID, {(float)-(obj->size*obj->scale).x/20,(float)-(obj->size*obj->scale).y/20});
-                // b2Vec2 p = b2Body_GetWorldPoint(bodyID, {0,0});
-                b2Rot rotation = b2Body_GetRotation(bodyID);
-                float radians = b2Rot_GetAngle(rotation);
+            static constexpr bool dense_storage=true;
+            using findable_as=std::tuple<DynamicBody>;
+            b2BodyId bodyID=b2_nullBodyId;
+            Object* owner=nullptr;
+            b2Transform previous_transform;
+            b2Transform current_transform;
+            uint64_t moved_step=0;
+            bool settled=true;
+            void SetTransform(Object* obj, b2Transform transform) {
+                b2Vec2 p = b2TransformPoint(transform, {(float)-(obj->size*obj->scale).x/20,(float)-(obj->size*obj->scale).y/20});
+                float radians = b2Rot_GetAngle(transform.q);
                 obj->position=Vec2(p.x,p.y);
                 obj->rotation=radians * RAD2DEG;
             }
+            // Called from the world's move events, bodies that didn't move (or are asleep) are never touched
+            void OnMove(b2Transform transform) {
+                previous_transform=current_transform;
+                current_transform=transform;
+                moved_step=Time::steps;
+                if(!Time::fixed_step)
+                    SetTransform(owner, transform);
+            }
+            void UpdateComponent(Object* obj)override {
+                if(!Time::fixed_step) return;
+                if(moved_step==Time::steps) {
+                    // Draw between the last two physics states so motion stays smooth at any tick rate
+                    b2Transform transform;
+                    transform.p=b2Lerp(previous_transform.p, current_transform.p, Time::alpha);
+                    transform.q=b2NLerp(previous_transform.q, current_transform.q, Time::alpha);
+                    SetTransform(obj, transform);
+                    settled=false;
+                } else if(!settled) {
+                    SetTransform(obj, current_transform);
+                    settled=true;
+                }
+            }
             void Box2dSceneInit(b2WorldId id, Object* obj)override{
                 b2BodyDef b=b2DefaultBodyDef();
                 b.type = b2_dynamicBody;
                 b.position=obj->position+(obj->scale*obj->scale)/40;
                 b.rotation.s=obj->rotation.num * DEG2RAD;
+                b.userData=this;
                 bodyID=b2CreateBody(id, &b);
                 b2ShapeDef shapeDef = b2DefaultShapeDef();
                 b2Polygon polygon=b2MakeBox((obj->size*obj->scale).x/4,(obj->size*obj->scale).y/4);
                 b2CreatePolygonShape(bodyID, &shapeDef, &polygon);
+                owner=obj;
+                current_transform=b2Body_GetTransform(bodyID);
+                previous_transform=current_transform;
+                SetTransform(obj, current_transform);
+            }
+            void Box2dSceneDestroy(Object* obj)override{
+                if(B2_IS_NON_NULL(bodyID) && b2Body_IsValid(bodyID))
+                    b2DestroyBody(bodyID);
+                bodyID=b2_nullBodyId;
             }
             void ApplyForce(Vec2 impulse){
                 b2Body_ApplyForceToCenter(bodyID, impulse*100, true);
@@ -273,7 +654,13 @@ namespace Engine{
     };
     class StaticBody : public Component {
         public:
-            b2BodyId bodyID;
+            using findable_as=std::tuple<StaticBody>;
+            b2BodyId bodyID=b2_nullBodyId;
+            void Box2dSceneDestroy(Object* obj)override{
+                if(B2_IS_NON_NULL(bodyID) && b2Body_IsValid(bodyID))
+                    b2DestroyBody(bodyID);
+                bodyID=b2_nullBodyId;
+            }
             void Box2dSceneInit(b2WorldId id, Object* obj)override{
                 b2BodyDef b=b2DefaultBodyDef();
                 b.type = b2_staticBody;
@@ -299,50 +686,93 @@ namespace Engine{
     };
     class ImageTexture {
         private:
-            Image image=GenImageColor(40, 40, MAGENTA);
-            Texture2D texture;
-            bool texture_loaded=false;
+            // Shared with every ImageTexture loaded from the same path
+            std::shared_ptr<TextureResource> resource;
+            // Set by Pack, the texture is then the atlas page and Source() the image's place on it
+            TextureAtlas* atlas=nullptr;
+            int atlas_entry=-1;
         public:
-            ImageTexture(const char* path) : image(LoadImage(path)), texture_loaded(false) {}
-            ImageTexture() : image(GenImageColor(60, 60, MAGENTA)), texture_loaded(false) {}
+            ImageTexture(const char* path) : resource(TextureCache::Load(path)) {}
+            ImageTexture() : resource(TextureCache::Default()) {}
             operator Texture2D() {
-                return texture;
+                return GetTexture();
             }
             operator Image() {
-                return image;
+                return resource->image;
             }
+            // The image is shared, edits show up in every ImageTexture using it once its texture is reloaded
             Image& GetImage() {
-                return image;
+                return resource->image;
             }
             Texture2D& GetTexture() {
-                if(texture_loaded==false) {
-                    texture=LoadTextureFromImage(image);
-                    texture_loaded=true;
-                }
-                return texture;
+                if(atlas!=nullptr)
+                    return atlas->GetTexture(atlas_entry);
+                return resource->GetTexture();
+            }
+            Rectangle Source() {
+                if(atlas!=nullptr)
+                    return atlas->Source(atlas_entry);
+                Texture2D& t=GetTexture();
+                return Rectangle{0, 0, float(t.width), float(t.height)};
             }
+            // Moves the image into a shared atlas page. Set() detaches it again, the atlas entry stays until the
+            // image is unloaded. ImageTextures sharing an image share its atlas entry too.
+            void Pack(TextureAtlas& a) {
+                atlas_entry=resource->AtlasEntry(a);
+                atlas=&a;
+            }
+            int AtlasEntry()const{
+                return atlas_entry;
+            }
+            // Takes ownership of img, it's unloaded once nothing uses it
             void Set(Image img) {
-                image=img;
-                texture=LoadTextureFromImage(image);
-                texture_loaded=true;
+                atlas=nullptr;
+                resource=TextureCache::Adopt(img);
+                resource->GetTexture();
             }
             void Set(Texture2D tex) {
-                texture=tex;
-                image=LoadImageFromTexture(texture);
-                texture_loaded=true;
+                atlas=nullptr;
+                resource=TextureCache::Adopt(tex);
             }
     };
     class TextureObject : public Object {
         public:
             ImageTexture tex;
             Color tint=WHITE;
+            // Leave the id at 0 for raylib's default shader
+            Shader shader={0, nullptr};
+            int blend_mode=BLEND_ALPHA;
             TextureObject() : tex(ImageTexture()) {
                 size=Vec2(20,20);
             }
             virtual void Draw()override{
                 Rectangle rect={float(position.x),float(position.y),float(size.x*scale.x),float(size.y*scale.y)};
-                NPatchInfo n={};
-                DrawTextureNPatch(tex.GetTexture(), NPatchInfo(), rect, Vector2{0,0}, rotation, tint);
+                if(shader.id!=0) BeginShaderMode(shader);
+                // BLEND_ALPHA keeps whatever mode the caller set up, e.g. the static cache's
+                if(blend_mode!=BLEND_ALPHA) BeginBlendMode(blend_mode);
+                DrawTexturePro(tex.GetTexture(), tex.Source(), rect, Vector2{0,0}, rotation, tint);
+                if(blend_mode!=BLEND_ALPHA) EndBlendMode();
+                if(shader.id!=0) EndShaderMode();
+            }
+            virtual bool WorldBounds(b2AABB& box)override{
+                double rads=rotation.num*(PI/180);
+                double cs=cos(rads);
+                double sn=sin(rads);
+                double w=size.x*scale.x;
+                double h=size.y*scale.y;
+                // Corners relative to the top left one, which the texture is rotated around
+                double xs[4]={0, w*cs, w*cs-h*sn, -h*sn};
+                double ys[4]={0, w*sn, w*sn+h*cs, h*cs};
+                box.lowerBound={float(position.x+*std::min_element(xs, xs+4)), float(position.y+*std::min_element(ys, ys+4))};
+                box.upperBound={float(position.x+*std::max_element(xs, xs+4)), float(position.y+*std::max_element(ys, ys+4))};
+                return true;
+            }
+            virtual bool Snapshot(std::vector<DrawItem>& items)override{
+                Rectangle rect={float(position.x),float(position.y),float(size.x*scale.x),float(size.y*scale.y)};
+                Texture2D& t=tex.GetTexture();
+                uint64_t key=RenderQueue::Key(layer, depth, shader.id, t.id, blend_mode);
+                items.push_back(DrawItem{t, tex.Source(), rect, float(rotation.num), tint, key, shader, blend_mode});
+                return true;
             }
     };
     class Cam {
@@ -356,29 +786,701 @@ namespace Engine{
             }
     };
 
+    // Structural changes queued during a frame, applied together at the end of it
+    struct CommandBuffer{
+        enum class TYPE {
+            SPAWN,
+            DESTROY,
+            SET_PARENT,
+            ADD_COMPONENT,
+            REMOVE_COMPONENT,
+        };
+        struct Command{
+            TYPE type;
+            Handle target;
+            Handle other;
+            Component* component;
+        };
+        std::mutex mtx;
+        std::vector<Command> queued;
+        std::vector<Command> flushing;
+        std::vector<Handle> spawned;
+    };
+
+    // Spatial index of drawable objects' world bounds, queried with the camera view every frame
+    struct CullTree{
+        b2DynamicTree tree=b2DynamicTree_Create();
+        // Boxes are inserted enlarged by this much so small movements don't touch the tree
+        float margin=16;
+        CullTree()=default;
+        CullTree(const CullTree&)=delete;
+        ~CullTree() {
+            b2DynamicTree_Destroy(&tree);
+        }
+    };
+
+    // Adds obj to items, objects that aren't batchable are queued to draw through Draw() at their place in the order
+    inline void QueueObject(Object* obj, std::vector<DrawItem>& items) {
+        if(obj->batchable && obj->Snapshot(items)) return;
+        DrawItem item={};
+        item.key=RenderQueue::Key(obj->layer, obj->depth, 0, 0, BLEND_ALPHA);
+        item.object=obj;
+        items.push_back(item);
+    }
+    // Renders static_layer objects into RenderTexture2D tiles once and draws the tiles in their place.
+    // Only tiles around the view keep a texture, a tile is drawn again after something in it is invalidated.
+    struct StaticCache{
+        struct Tile{
+            RenderTexture2D target;
+            bool loaded=false;
+            bool dirty=true;
+            std::vector<Object*> objects;
+        };
+        // World units per tile side
+        float tile_size=512;
+        // Texture pixels per world unit
+        float resolution=1;
+        // How many tiles past the view keep their texture
+        int border=1;
+        // Tiles draw below everything else in this layer
+        uint8_t layer=0;
+        std::unordered_map<uint64_t, Tile> tiles;
+        // Objects added since the last Update, filed there so their position can still be set after adding them
+        std::vector<Object*> pending;
+        RenderQueue queue;
+        StaticCache()=default;
+        StaticCache(const StaticCache&)=delete;
+
+        static uint64_t Key(int x, int y) {
+            return uint64_t(uint32_t(x))<<32 | uint32_t(y);
+        }
+        void Range(b2AABB box, int& x0, int& y0, int& x1, int& y1)const{
+            x0=int(std::floor(box.lowerBound.x/tile_size));
+            y0=int(std::floor(box.lowerBound.y/tile_size));
+            x1=int(std::floor(box.upperBound.x/tile_size));
+            y1=int(std::floor(box.upperBound.y/tile_size));
+        }
+        void DeferAdd(Object* obj) {
+            if(obj->static_pending || obj->static_cached) return;
+            obj->static_pending=true;
+            pending.push_back(obj);
+        }
+        // Files obj under every tile its bounds touch, objects without bounds can't be cached
+        bool Add(Object* obj) {
+            b2AABB box;
+            if(!obj->WorldBounds(box)) return false;
+            int x0, y0, x1, y1;
+            Range(box, x0, y0, x1, y1);
+            for(int x=x0; x<=x1; x++) {
+                for(int y=y0; y<=y1; y++) {
+                    Tile& t=tiles[Key(x, y)];
+                    t.objects.push_back(obj);
+                    t.dirty=true;
+                }
+            }
+            obj->static_box=box;
+            obj->static_cached=true;
+            obj->MarkMoved();
+            return true;
+        }
+        // Emptied tiles are only unloaded by the next Update, the current frame may still be drawing them
+        void Remove(Object* obj) {
+            if(obj->static_pending) {
+                auto found=std::find(pending.begin(), pending.end(), obj);
+                if(found!=pending.end()) pending.erase(found);
+                obj->static_pending=false;
+            }
+            if(!obj->static_cached) return;
+            int x0, y0, x1, y1;
+            Range(obj->static_box, x0, y0, x1, y1);
+            for(int x=x0; x<=x1; x++) {
+                for(int y=y0; y<=y1; y++) {
+                    auto it=tiles.find(Key(x, y));
+                    if(it==tiles.end()) continue;
+                    Tile& t=it->second;
+                    auto found=std::find(t.objects.begin(), t.objects.end(), obj);
+                    if(found==t.objects.end()) continue;
+                    t.objects.erase(found);
+                    t.dirty=true;
+                }
+            }
+            obj->static_cached=false;
+            obj->MarkMoved();
+        }
+        bool InRange(uint64_t key, int x0, int y0, int x1, int y1)const{
+            int x=int(uint32_t(key>>32));
+            int y=int(uint32_t(key));
+            return x>=x0-border && x<=x1+border && y>=y0-border && y<=y1+border;
+        }
+        // Drops empty tiles and the textures of tiles that left the range around view, true if a tile in range
+        // must be rendered. Unloads textures, so it runs on the render thread.
+        bool Update(b2AABB view) {
+            int x0, y0, x1, y1;
+            Range(view, x0, y0, x1, y1);
+            bool render=false;
+            for(auto obj : pending) {
+                obj->static_pending=false;
+                Add(obj);
+            }
+            pending.clear();
+            for(auto it=tiles.begin(); it!=tiles.end();) {
+                Tile& t=it->second;
+                if(t.objects.empty()) {
+                    if(t.loaded) UnloadRenderTexture(t.target);
+                    it=tiles.erase(it);
+                    continue;
+                }
+                if(!InRange(it->first, x0, y0, x1, y1)) {
+                    if(t.loaded) UnloadRenderTexture(t.target);
+                    t.loaded=false;
+                    t.dirty=true;
+                } else if(t.dirty || !t.loaded) {
+                    render=true;
+                }
+                ++it;
+            }
+            return render;
+        }
+        // Renders the tiles in range that need it. Switches render targets, so call it outside of 2D mode.
+        void Render(b2AABB view) {
+            PROFILE_SCOPE("Static Tiles");
+            int x0, y0, x1, y1;
+            Range(view, x0, y0, x1, y1);
+            int pixels=int(tile_size*resolution);
+            // Colour is blended as usual, alpha accumulates as a+dst*(1-a), so tiles come out premultiplied
+            rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+            queue.alpha_blend=BLEND_CUSTOM_SEPARATE;
+            for(auto& [key, t] : tiles) {
+                if(!InRange(key, x0, y0, x1, y1) || (!t.dirty && t.loaded)) continue;
+                if(!t.loaded) {
+                    t.target=LoadRenderTexture(pixels, pixels);
+                    t.loaded=true;
+                }
+                Vector2 origin={int(uint32_t(key>>32))*tile_size, int(uint32_t(key))*tile_size};
+                BeginTextureMode(t.target);
+                ClearBackground(BLANK);
+                BeginMode2D(Camera2D{Vector2{0, 0}, origin, 0, resolution});
+                for(auto obj : t.objects) {
+                    if(obj->visible) QueueObject(obj, queue.items);
+                }
+                queue.Flush([](Object* obj) { obj->Draw(); });
+                EndMode2D();
+                EndTextureMode();
+                t.dirty=false;
+            }
+        }
+        // Adds the rendered tiles overlapping view to items
+        void Queue(b2AABB view, std::vector<DrawItem>& items) {
+            int x0, y0, x1, y1;
+            Range(view, x0, y0, x1, y1);
+            for(int x=x0; x<=x1; x++) {
+                for(int y=y0; y<=y1; y++) {
+                    auto it=tiles.find(Key(x, y));
+                    if(it==tiles.end() || !it->second.loaded) continue;
+                    Texture2D& tex=it->second.target.texture;
+                    DrawItem item={};
+                    item.texture=tex;
+                    // Render textures are stored upside down
+                    item.source={0, float(tex.height), float(tex.width), -float(tex.height)};
+                    item.rect={x*tile_size, y*tile_size, tile_size, tile_size};
+                    item.tint=WHITE;
+                    // The tile was blended over a transparent clear, so its colour is premultiplied
+                    item.blend=BLEND_ALPHA_PREMULTIPLY;
+                    item.key=RenderQueue::Key(layer, INT16_MIN, 0, tex.id, item.blend);
+                    items.push_back(item);
+                }
+            }
+        }
+        // Must run while the GL context still exists
+        void Clear() {
+            for(auto& [key, t] : tiles) {
+                if(t.loaded) UnloadRenderTexture(t.target);
+            }
+            tiles.clear();
+            pending.clear();
+            queue.Unload();
+        }
+    };
+
     struct Scene{
         std::vector<Object*> objects={};
         Color bgColor=WHITE;
         Cam camera=Cam();
         b2WorldId worldID;
+        std::shared_ptr<JobSystem> jobs;
+        int parallel_chunk=64;
+        std::vector<Object*> parallel_objects;
+        std::shared_ptr<PoolSet> pools=std::make_shared<PoolSet>();
+        std::shared_ptr<CommandBuffer> commands=std::make_shared<CommandBuffer>();
+        std::shared_ptr<RenderQueue> render=std::make_shared<RenderQueue>();
+        std::shared_ptr<CullTree> culling=std::make_shared<CullTree>();
+        std::shared_ptr<StaticCache> statics=std::make_shared<StaticCache>();
+        // Drawables that overlap the view this frame, in drawables order
+        std::vector<Object*> visible;
+        // True while the frame iterates objects, AddObject is deferred to the command buffer then
+        bool updating=false;
         Scene() {
             b2WorldDef worlddef=b2DefaultWorldDef();
             worldID=b2CreateWorld(&worlddef);
         }
-        void AddObject(Object* obj) {
+        Scene(int worker_count, bool pin_threads=false) : jobs(std::make_shared<JobSystem>(worker_count, pin_threads)) {
+            b2WorldDef worlddef=b2DefaultWorldDef();
+            worlddef.workerCount=jobs->WorkerCount();
+            worlddef.enqueueTask=JobSystem::EnqueueTask;
+            worlddef.finishTask=JobSystem::FinishTask;
+            worlddef.userTaskContext=jobs.get();
+            worldID=b2CreateWorld(&worlddef);
+        }
+        struct Slot{
+            Object* object=nullptr;
+            uint32_t generation=0;
+        };
+        std::vector<Slot> slots;
+        std::vector<uint32_t> free_slots;
+        // Dense per-frame lists, objects only sit in the ones whose hooks they use
+        std::vector<Object*> updatables;
+        std::vector<Object*> drawables;
+        std::vector<Object*> component_objects;
+        static void ListAdd(std::vector<Object*>& list, Object* obj, int Object::* index) {
+            if(obj->*index>=0) return;
+            obj->*index=list.size();
+            list.push_back(obj);
+        }
+        static void ListRemove(std::vector<Object*>& list, Object* obj, int Object::* index) {
+            int i=obj->*index;
+            if(i<0) return;
+            list[i]=list.back();
+            list[i]->*index=i;
+            list.pop_back();
+            obj->*index=-1;
+        }
+        static bool NeedsComponentUpdate(Object* obj) {
+            if(obj->ticks_components) return true;
+            for(auto i : obj->components) {
+                if(!i->dense) return true;
+            }
+            return false;
+        }
+        void Track(Object* obj) {
+            if(obj->ticks_update) ListAdd(updatables, obj, &Object::update_index);
+            if(obj->ticks_draw && obj->draw_index<0) {
+                ListAdd(drawables, obj, &Object::draw_index);
+                Moved(obj);
+            }
+            if(NeedsComponentUpdate(obj)) ListAdd(component_objects, obj, &Object::component_index);
+        }
+        // Objects carrying each tag bit
+        std::vector<Object*> tagged[64];
+        void TagAdd(Object* obj, uint64_t mask) {
+            if(mask==0) return;
+            if(obj->tag_index.empty()) obj->tag_index.assign(64, -1);
+            for(int bit=0; mask!=0; bit++, mask>>=1) {
+                if(!(mask&1) || obj->tag_index[bit]>=0) continue;
+                obj->tag_index[bit]=tagged[bit].size();
+                tagged[bit].push_back(obj);
+            }
+        }
+        void TagRemove(Object* obj, uint64_t mask) {
+            if(obj->tag_index.empty()) return;
+            for(int bit=0; mask!=0; bit++, mask>>=1) {
+                int i=obj->tag_index[bit];
+                if(!(mask&1) || i<0) continue;
+                auto& list=tagged[bit];
+                list[i]=list.back();
+                list[i]->tag_index[bit]=i;
+                list.pop_back();
+                obj->tag_index[bit]=-1;
+            }
+        }
+        // fn(Object*) for every object in the scene carrying all the tags in mask. Only walks the shortest of
+        // their lists. Use Destroy rather than RemoveObject from fn.
+        template<typename F> void ForEachWithTags(uint64_t mask, F fn) {
+            if(mask==0) return;
+            std::vector<Object*>* shortest=nullptr;
+            for(int bit=0; bit<64; bit++) {
+                if((mask>>bit)&1 && (shortest==nullptr || tagged[bit].size()<shortest->size()))
+                    shortest=&tagged[bit];
+            }
+            for(int i=0; i<shortest->size(); i++) {
+                Object* obj=(*shortest)[i];
+                if(obj->HasTags(mask)) fn(obj);
+            }
+        }
+        // Objects woken by a signal, put back to sleep after the next step if their body is still asleep
+        std::vector<Handle> sleep_checks;
+        void Sleep(Object* obj) {
+            if(obj->dormant) return;
+            obj->dormant=true;
+            ListRemove(updatables, obj, &Object::update_index);
+            ListRemove(component_objects, obj, &Object::component_index);
+        }
+        void Wake(Object* obj) {
+            if(!obj->dormant) return;
+            obj->dormant=false;
+            Track(obj);
+        }
+        void Untrack(Object* obj) {
+            ListRemove(updatables, obj, &Object::update_index);
+            ListRemove(drawables, obj, &Object::draw_index);
+            ListRemove(component_objects, obj, &Object::component_index);
+            ListRemove(unculled, obj, &Object::unculled_index);
+            ListRemove(moved, obj, &Object::moved_index);
+            RemoveProxy(obj);
+        }
+        void RemoveProxy(Object* obj) {
+            if(obj->cull_proxy<0) return;
+            b2DynamicTree_DestroyProxy(&culling->tree, obj->cull_proxy);
+            obj->cull_proxy=-1;
+        }
+        // Drawables whose bounds must be recomputed, and drawables without bounds that are never culled
+        std::vector<Object*> moved;
+        std::vector<Object*> unculled;
+        // Unlocked version of Object::MarkMoved for the scene's own single threaded passes
+        void Moved(Object* obj) {
+            if(obj->draw_index<0) return;
+            ListAdd(moved, obj, &Object::moved_index);
+        }
+        static bool PoseChanged(Object* obj) {
+            return obj->position!=obj->bounds_position || obj->rotation.num!=obj->bounds_rotation
+                || obj->size!=obj->bounds_size || obj->scale!=obj->bounds_scale;
+        }
+        // Refreshes the culling tree for the drawables that moved. Their pose is compared without calling
+        // WorldBounds(), and only the ones that left their enlarged box are moved in the tree.
+        void UpdateBounds() {
+            PROFILE_SCOPE("Bounds");
+            for(auto obj : drawables) {
+                if(obj->cull_proxy>=0 && obj->moved_index<0 && PoseChanged(obj)) Moved(obj);
+            }
+            for(auto obj : moved) {
+                obj->moved_index=-1;
+                obj->bounds_position=obj->position;
+                obj->bounds_rotation=obj->rotation.num;
+                obj->bounds_size=obj->size;
+                obj->bounds_scale=obj->scale;
+                b2AABB box;
+                if(obj->static_cached) {
+                    RemoveProxy(obj);
+                    ListRemove(unculled, obj, &Object::unculled_index);
+                    continue;
+                }
+                if(!obj->WorldBounds(box)) {
+                    RemoveProxy(obj);
+                    ListAdd(unculled, obj, &Object::unculled_index);
+                    continue;
+                }
+                ListRemove(unculled, obj, &Object::unculled_index);
+                if(obj->cull_proxy>=0 && b2AABB_Contains(obj->cull_box, box)) continue;
+                float m=culling->margin;
+                obj->cull_box={{box.lowerBound.x-m, box.lowerBound.y-m}, {box.upperBound.x+m, box.upperBound.y+m}};
+                if(obj->cull_proxy<0)
+                    obj->cull_proxy=b2DynamicTree_CreateProxy(&culling->tree, obj->cull_box, B2_DEFAULT_CATEGORY_BITS, obj->handle.index);
+                else
+                    b2DynamicTree_MoveProxy(&culling->tree, obj->cull_proxy, obj->cull_box);
+            }
+            moved.clear();
+        }
+        static bool CullQuery(int proxy, int slot, void* context) {
+            Scene* scene=static_cast<Scene*>(context);
+            Object* obj=scene->slots[slot].object;
+            if(obj->visible) scene->visible.push_back(obj);
+            return true;
+        }
+        // Fills visible with the drawables whose bounds overlap view, plus every visible object without bounds
+        std::vector<Object*>& CollectVisible(b2AABB view) {
+            UpdateBounds();
+            visible.clear();
+            for(auto obj : unculled) {
+                if(obj->visible) visible.push_back(obj);
+            }
+            b2DynamicTree_Query(&culling->tree, view, B2_DEFAULT_MASK_BITS, CullQuery, this);
+            std::sort(visible.begin(), visible.end(), [](Object* a, Object* b) {
+                return a->draw_index<b->draw_index;
+            });
+            return visible;
+        }
+        // Objects that have a parent or children, and objects whose world transform needs rebuilding
+        std::vector<Handle> transform_nodes;
+        std::vector<Handle> dirty_transforms;
+        std::shared_ptr<std::mutex> transform_mtx=std::make_shared<std::mutex>();
+        void AddTransformNode(Object* obj) {
+            if(obj->transform_node) return;
+            obj->transform_node=true;
+            transform_nodes.push_back(obj->handle);
+        }
+        Handle Register(Object* obj) {
+            Handle h;
+            if(!free_slots.empty()) {
+                h.index=free_slots.back();
+                free_slots.pop_back();
+            } else {
+                h.index=slots.size();
+                slots.emplace_back();
+            }
+            slots[h.index].object=obj;
+            h.generation=slots[h.index].generation;
+            obj->handle=h;
+            obj->scene=this;
+            return h;
+        }
+        // Bumping the generation invalidates every handle still pointing at the slot
+        void Release(Handle h) {
+            if(!IsValid(h)) return;
+            slots[h.index].object=nullptr;
+            slots[h.index].generation++;
+            free_slots.push_back(h.index);
+        }
+        bool IsValid(Handle h)const{
+            return h.index<slots.size() && slots[h.index].generation==h.generation && slots[h.index].object!=nullptr;
+        }
+        Object* Get(Handle h)const{
+            return IsValid(h) ? slots[h.index].object : nullptr;
+        }
+        Handle AddObject(Object* obj) {
+            if(updating) return Spawn(obj);
+            Handle h=Register(obj);
+            obj->scene_index=objects.size();
             objects.emplace_back(obj);
             objects.back()->Start();
+            Track(obj);
+            TagAdd(obj, obj->Tags());
+            if(obj->static_layer) statics->DeferAdd(obj);
             for(auto i : obj->components) {
                 i->Box2dSceneInit(worldID,obj);
             }
+            obj->in_scene=true;
+            return h;
         }
-        template<typename T> void AddObject() {
-            T* t=new T;
-            objects.emplace_back(t);
-            objects.back()->Start();
-            for(auto i : t->components) {
-                i->Box2dSceneInit(worldID,t);
+        // Allocates T from this scene's pools, along with every component it adds
+        template<typename T> T* Allocate() {
+            Pool<T>& p=pools->Get<T>();
+            int slot;
+            PoolSet::constructing=pools.get();
+            T* t=p.Create(nullptr, slot);
+            PoolSet::constructing=nullptr;
+            p.SetOwner(slot, t);
+            t->pool=&p;
+            t->pool_slot=slot;
+            t->ticks_update=t->ticks_update && ObjectHooks<T>::update;
+            t->ticks_draw=t->ticks_draw && ObjectHooks<T>::draw;
+            t->ticks_components=t->ticks_components && ObjectHooks<T>::components;
+            t->batchable=ObjectHooks<T>::snapshot;
+            return t;
+        }
+        template<typename T> Handle AddObject() {
+            if(updating) return Spawn<T>();
+            return AddObject(Allocate<T>());
+        }
+        // Deferred versions, safe to call while objects are being iterated (and from parallel Update).
+        // The handle is valid right away but the object only joins `objects` when the commands are flushed.
+        Handle Spawn(Object* obj) {
+            std::lock_guard<std::mutex> lock(commands->mtx);
+            Handle h=Register(obj);
+            commands->queued.push_back({CommandBuffer::TYPE::SPAWN, h, Handle(), nullptr});
+            return h;
+        }
+        template<typename T> Handle Spawn() {
+            T* t;
+            {
+                std::lock_guard<std::mutex> lock(commands->mtx);
+                t=Allocate<T>();
             }
+            return Spawn(t);
+        }
+        // Removes the object and all of its children at the end of the frame, along with their physics bodies
+        void Destroy(Handle h) {
+            std::lock_guard<std::mutex> lock(commands->mtx);
+            commands->queued.push_back({CommandBuffer::TYPE::DESTROY, h, Handle(), nullptr});
+        }
+        void Destroy(Object* obj) {
+            Destroy(obj->handle);
+        }
+        void DeferSetParent(Handle child, Handle parent) {
+            std::lock_guard<std::mutex> lock(commands->mtx);
+            commands->queued.push_back({CommandBuffer::TYPE::SET_PARENT, child, parent, nullptr});
+        }
+        template<typename T> T* DeferAddComponent(Handle h) {
+            std::lock_guard<std::mutex> lock(commands->mtx);
+            Object* obj=Get(h);
+            if(obj==nullptr) return nullptr;
+            T* t=obj->CreateComponent<T>();
+            commands->queued.push_back({CommandBuffer::TYPE::ADD_COMPONENT, h, Handle(), t});
+            return t;
+        }
+        // Removing the same component twice in a frame only queues it once
+        void DeferRemoveComponent(Handle h, Component* c) {
+            std::lock_guard<std::mutex> lock(commands->mtx);
+            for(auto& i : commands->queued) {
+                if(i.type==CommandBuffer::TYPE::REMOVE_COMPONENT && i.component==c) return;
+            }
+            commands->queued.push_back({CommandBuffer::TYPE::REMOVE_COMPONENT, h, Handle(), c});
+        }
+        // Immediate removal, use Destroy while the frame is running. Swap-and-pop, so object order isn't kept.
+        void RemoveObject(Handle h) {
+            Object* obj=Get(h);
+            if(obj==nullptr) return;
+            SetParent(h, Handle());
+            while(!obj->children.empty()) {
+                Handle child=obj->children.back();
+                obj->children.pop_back();
+                if(Object* c=Get(child)) {
+                    c->parent=Handle();
+                    RemoveObject(child);
+                }
+            }
+            Untrack(obj);
+            TagRemove(obj, obj->Tags());
+            statics->Remove(obj);
+            int index=obj->scene_index;
+            if(index>=0) {
+                objects[index]=objects.back();
+                objects[index]->scene_index=index;
+                objects.pop_back();
+            }
+            for(auto i : obj->components) {
+                i->Box2dSceneDestroy(obj);
+            }
+            obj->UnsubscribeAll();
+            Release(h);
+            FreeObject(obj);
+        }
+        // Applies every queued command in order. New objects are appended with one reserve, started,
+        // and then get their physics bodies created in one batch.
+        void FlushCommands() {
+            auto& list=commands->flushing;
+            {
+                std::lock_guard<std::mutex> lock(commands->mtx);
+                std::swap(commands->queued, list);
+            }
+            if(list.empty()) return;
+            int spawn_count=0;
+            for(auto& i : list) {
+                if(i.type==CommandBuffer::TYPE::SPAWN) spawn_count++;
+            }
+            objects.reserve(objects.size()+spawn_count);
+            auto& spawned=commands->spawned;
+            for(auto& i : list) {
+                Object* obj=Get(i.target);
+                switch(i.type) {
+                    case CommandBuffer::TYPE::SPAWN:
+                        if(obj==nullptr) break;
+                        obj->scene_index=objects.size();
+                        objects.push_back(obj);
+                        obj->Start();
+                        Track(obj);
+                        TagAdd(obj, obj->Tags());
+                        if(obj->static_layer) statics->DeferAdd(obj);
+                        spawned.push_back(i.target);
+                        break;
+                    case CommandBuffer::TYPE::DESTROY:
+                        RemoveObject(i.target);
+                        break;
+                    case CommandBuffer::TYPE::SET_PARENT:
+                        SetParent(i.target, i.other);
+                        break;
+                    case CommandBuffer::TYPE::ADD_COMPONENT:
+                        if(obj==nullptr) {
+                            FreeComponent(i.component);
+                            break;
+                        }
+                        obj->AttachComponent(i.component);
+                        if(obj->in_scene)
+                            i.component->Box2dSceneInit(worldID, obj);
+                        break;
+                    case CommandBuffer::TYPE::REMOVE_COMPONENT:
+                        // Components that aren't attached to the target are left alone
+                        if(obj==nullptr || !obj->DetachComponent(i.component)) break;
+                        i.component->Box2dSceneDestroy(obj);
+                        FreeComponent(i.component);
+                        break;
+                }
+            }
+            for(auto h : spawned) {
+                Object* obj=Get(h);
+                if(obj==nullptr) continue;
+                for(auto i : obj->components) {
+                    i->Box2dSceneInit(worldID, obj);
+                }
+                obj->in_scene=true;
+            }
+            spawned.clear();
+            list.clear();
+        }
+        // Attaches child to parent (or detaches it for an invalid parent) without moving it in world space
+        void SetParent(Handle child, Handle parent) {
+            Object* c=Get(child);
+            if(c==nullptr) return;
+            if(Object* old=Get(c->parent)) {
+                for(int i=0; i<old->children.size(); i++) {
+                    if(old->children[i]==child) {
+                        old->children[i]=old->children.back();
+                        old->children.pop_back();
+                        break;
+                    }
+                }
+            }
+            Object* p=Get(parent);
+            c->parent=p!=nullptr ? parent : Handle();
+            if(p==nullptr) {
+                c->local_position=c->position;
+                c->local_rotation=c->rotation.num;
+                c->local_scale=c->scale;
+            } else {
+                p->children.push_back(child);
+                c->local_position=(c->position-p->position).rotated(CircularNumber(-p->rotation.num))/p->scale;
+                c->local_rotation=c->rotation.num-p->rotation.num;
+                c->local_scale=c->scale/p->scale;
+                AddTransformNode(p);
+                AddTransformNode(c);
+            }
+            // The local transform now matches, so the next pass must not take the world one as a direct write
+            c->position_old=c->position;
+            c->rotation_old=c->rotation.num;
+            c->scale_old=c->scale;
+        }
+        // Drops every object at once, pooled objects and components go back with a single reset per pool
+        void Clear() {
+            {
+                std::lock_guard<std::mutex> lock(commands->mtx);
+                for(auto& i : commands->queued) {
+                    if(i.type==CommandBuffer::TYPE::SPAWN) {
+                        Object* obj=Get(i.target);
+                        if(obj==nullptr) continue;
+                        Release(i.target);
+                        obj->UnsubscribeAll();
+                        for(auto c : obj->components) {
+                            if(c->pool==nullptr) delete c;
+                        }
+                        if(obj->pool==nullptr) delete obj;
+                    } else if(i.type==CommandBuffer::TYPE::ADD_COMPONENT && i.component->pool==nullptr) {
+                        delete i.component;
+                    }
+                }
+                commands->queued.clear();
+            }
+            for(auto obj : objects) {
+                Release(obj->handle);
+                obj->UnsubscribeAll();
+                for(auto i : obj->components) {
+                    i->Box2dSceneDestroy(obj);
+                    if(i->pool==nullptr) delete i;
+                }
+                if(obj->pool==nullptr) delete obj;
+            }
+            objects.clear();
+            updatables.clear();
+            drawables.clear();
+            component_objects.clear();
+            visible.clear();
+            moved.clear();
+            unculled.clear();
+            culling=std::make_shared<CullTree>();
+            statics->Clear();
+            for(auto& i : tagged) {
+                i.clear();
+            }
+            transform_nodes.clear();
+            dirty_transforms.clear();
+            pools->Reset();
         }
         enum class PROPERTY {
             GRAVITY,
@@ -400,42 +1502,396 @@ namespace Engine{
 
     inline void Scene::Load() {
         Root::CurrentScene=*this;
+        for(auto& i : Root::CurrentScene.slots) {
+            if(i.object!=nullptr) i.object->scene=&Root::CurrentScene;
+        }
+    }
+    inline void Object::AttachComponent(Component* c) {
+        components.emplace_back(c);
+        auto file=[this, c](int id) {
+            if(id>=component_slots.size()) component_slots.resize(id+1, nullptr);
+            if(component_slots[id]==nullptr) component_slots[id]=c;
+        };
+        file(c->type_id);
+        if(c->base_ids!=nullptr) {
+            for(int id : *c->base_ids) {
+                file(id);
+            }
+        }
+        if(in_scene && !dormant && !c->dense && scene!=nullptr)
+            Scene::ListAdd(scene->component_objects, this, &Object::component_index);
+    }
+    inline void Object::InvalidateStatic() {
+        if(scene==nullptr || !static_cached) return;
+        scene->statics->Remove(this);
+        scene->statics->DeferAdd(this);
+    }
+    inline void Object::SetTags(uint64_t mask) {
+        if(scene!=nullptr && scene_index>=0) {
+            scene->TagRemove(this, tags&~mask);
+            scene->TagAdd(this, mask&~tags);
+        }
+        tags=mask;
+    }
+    inline void Object::MarkMoved() {
+        if(scene==nullptr) return;
+        std::lock_guard<std::mutex> lock(*scene->transform_mtx);
+        scene->Moved(this);
+    }
+    inline void Object::MarkTransformDirty() {
+        if(scene==nullptr) return;
+        std::lock_guard<std::mutex> lock(*scene->transform_mtx);
+        if(transform_dirty) return;
+        transform_dirty=true;
+        scene->dirty_transforms.push_back(handle);
+    }
+    // Breadth-first pass over only the subtrees that changed this frame
+    inline void UpdateTransforms(Scene& scene) {
+        PROFILE_SCOPE("Transforms");
+        // Pick up world transforms that were written directly, at any level of the hierarchy
+        for(int i=0; i<scene.transform_nodes.size(); i++) {
+            Object* obj=scene.Get(scene.transform_nodes[i]);
+            Object* p=obj!=nullptr ? scene.Get(obj->parent) : nullptr;
+            if(obj==nullptr || (p==nullptr && obj->children.empty())) {
+                if(obj!=nullptr) obj->transform_node=false;
+                scene.transform_nodes[i]=scene.transform_nodes.back();
+                scene.transform_nodes.pop_back();
+                i--;
+                continue;
+            }
+            if(obj->transform_dirty) continue;
+            if(obj->position==obj->position_old && obj->rotation.num==obj->rotation_old && obj->scale==obj->scale_old) continue;
+            if(p!=nullptr) {
+                obj->local_position=(obj->position-p->position_old).rotated(CircularNumber(-p->rotation_old))/p->scale_old;
+                obj->local_rotation=obj->rotation.num-p->rotation_old;
+                obj->local_scale=obj->scale/p->scale_old;
+            } else {
+                obj->local_position=obj->position;
+                obj->local_rotation=obj->rotation.num;
+                obj->local_scale=obj->scale;
+            }
+            obj->transform_dirty=true;
+            scene.dirty_transforms.push_back(obj->handle);
+        }
+        auto& queue=scene.dirty_transforms;
+        for(int i=0; i<queue.size(); i++) {
+            Object* obj=scene.Get(queue[i]);
+            if(obj==nullptr) continue;
+            obj->transform_dirty=false;
+            if(Object* p=scene.Get(obj->parent)) {
+                obj->position=p->position+(obj->local_position*p->scale).rotated(p->rotation);
+                obj->rotation=p->rotation.num+obj->local_rotation.num;
+                obj->scale=p->scale*obj->local_scale;
+            }
+            obj->position_old=obj->position;
+            obj->rotation_old=obj->rotation.num;
+            obj->scale_old=obj->scale;
+            for(auto h : obj->children) {
+                Object* c=scene.Get(h);
+                if(c!=nullptr && !c->transform_dirty) {
+                    c->transform_dirty=true;
+                    queue.push_back(h);
+                }
+            }
+        }
+        queue.clear();
+    }
+
+    inline void SyncBodies(Scene& scene) {
+        Time::steps++;
+        b2BodyEvents events=b2World_GetBodyEvents(scene.worldID);
+        for(int i=0; i<events.moveCount; i++) {
+            auto body=static_cast<DynamicBody*>(events.moveEvents[i].userData);
+            if(body==nullptr) continue;
+            body->OnMove(events.moveEvents[i].transform);
+            Object* owner=body->owner;
+            if(owner->sleeps_with_body) {
+                if(events.moveEvents[i].fellAsleep)
+                    scene.Sleep(owner);
+                else
+                    scene.Wake(owner);
+            }
+        }
+        for(auto h : scene.sleep_checks) {
+            Object* obj=scene.Get(h);
+            if(obj==nullptr || obj->dormant) continue;
+            DynamicBody* body=obj->GetComponent<DynamicBody>();
+            if(body!=nullptr && !b2Body_IsAwake(body->bodyID))
+                scene.Sleep(obj);
+        }
+        scene.sleep_checks.clear();
+    }
+
+    inline void StepPhysics(Scene& scene, float frame_time) {
+        PROFILE_SCOPE("Physics");
+        Stats::Timer timer(Stats::current.physics);
+        if(!Time::fixed_step) {
+            b2World_Step(scene.worldID, frame_time, Time::substeps);
+            Stats::AddStep(scene.worldID);
+            if(scene.jobs!=nullptr)
+                Stats::current.parallel_jobs=std::max(Stats::current.parallel_jobs, scene.jobs->PeakConcurrency());
+            SyncBodies(scene);
+            Time::alpha=1;
+            return;
+        }
+        const float step=1.0f/Time::tick_rate;
+        Time::accumulator+=std::min(frame_time, Time::max_frame_time);
+        int steps=0;
+        while(Time::accumulator>=step && steps<Time::max_steps) {
+            b2World_Step(scene.worldID, step, Time::substeps);
+            Stats::AddStep(scene.worldID);
+            if(scene.jobs!=nullptr)
+                Stats::current.parallel_jobs=std::max(Stats::current.parallel_jobs, scene.jobs->PeakConcurrency());
+            SyncBodies(scene);
+            Time::accumulator-=step;
+            steps++;
+        }
+        // Drop whatever is left over after max_steps so a slow frame can't snowball into the next one
+        if(Time::accumulator>=step) {
+            Time::accumulator=std::fmod(Time::accumulator, step);
+        }
+        Time::alpha=Time::accumulator/step;
+    }
+
+    inline void DispatchSignals(Scene& scene) {
+        PROFILE_SCOPE("Signals");
+        Stats::Timer timer(Stats::current.signals);
+        // Signals emitted while dispatching are delivered next frame
+        std::swap(Signals::pending, Signals::dispatching);
+        for(int i=Signals::dispatching.size()-1; i>=0; i--) {
+            SignalID signal=Signals::dispatching[i];
+            // Receivers can subscribe, unsubscribe and register new signals, which would move or reorder the list
+            Signals::receivers=Signals::subscribers[signal];
+            for(auto obj : Signals::receivers) {
+                // Unsubscribed earlier in this dispatch
+                auto& subs=obj->subscriptions;
+                if(std::find(subs.begin(), subs.end(), signal)==subs.end()) continue;
+                if(obj->dormant) {
+                    scene.Wake(obj);
+                    scene.sleep_checks.push_back(obj->handle);
+                }
+                obj->RecieveSignal(signal);
+            }
+        }
+        Signals::dispatching.clear();
+    }
+
+    inline void UpdateObjects(Scene& scene, float delta_time) {
+        PROFILE_SCOPE("Objects");
+        Stats::Timer timer(Stats::current.update);
+        scene.pools->UpdateSystems();
+        for(int j=0; j<scene.component_objects.size(); j++) {
+            scene.component_objects[j]->UpdateComponents();
+        }
+        if(scene.jobs==nullptr || scene.jobs->WorkerCount()==1) {
+            for(int j=0; j<scene.updatables.size(); j++) {
+                scene.updatables[j]->Update(delta_time);
+            }
+        } else {
+            scene.parallel_objects.clear();
+            for(auto i : scene.updatables) {
+                if(i->thread_safe)
+                    scene.parallel_objects.push_back(i);
+            }
+            auto update=[&scene, delta_time](int start, int end, uint32_t worker) {
+                for(int j=start; j<end; j++) {
+                    scene.parallel_objects[j]->Update(delta_time);
+                }
+            };
+            scene.jobs->ParallelFor(scene.parallel_objects.size(), scene.parallel_chunk, update);
+            // Serial phase: objects that aren't thread safe and structural changes
+            for(int j=0; j<scene.updatables.size(); j++) {
+                auto i=scene.updatables[j];
+                if(!i->thread_safe)
+                    i->Update(delta_time);
+            }
+        }
+        UpdateTransforms(scene);
+    }
+
+    // World space box around the screen as seen through camera, rotation and zoom included
+    inline b2AABB ViewBounds(Camera2D camera) {
+        float w=GetScreenWidth();
+        float h=GetScreenHeight();
+        Vector2 corners[4]={
+            GetScreenToWorld2D(Vector2{0, 0}, camera),
+            GetScreenToWorld2D(Vector2{w, 0}, camera),
+            GetScreenToWorld2D(Vector2{0, h}, camera),
+            GetScreenToWorld2D(Vector2{w, h}, camera),
+        };
+        b2AABB box={{corners[0].x, corners[0].y}, {corners[0].x, corners[0].y}};
+        for(auto& i : corners) {
+            box.lowerBound={std::min(box.lowerBound.x, i.x), std::min(box.lowerBound.y, i.y)};
+            box.upperBound={std::max(box.upperBound.x, i.x), std::max(box.upperBound.y, i.y)};
+        }
+        return box;
+    }
+    inline void DrawObjects(Scene& scene) {
+        PROFILE_SCOPE("Draw");
+        Stats::Timer timer(Stats::current.draw);
+        RenderQueue& queue=*scene.render;
+        b2AABB view=ViewBounds(scene.camera);
+        StaticCache& statics=*scene.statics;
+        if(statics.Update(view)) {
+            EndMode2D();
+            statics.Render(view);
+            BeginMode2D(scene.camera);
+        }
+        statics.Queue(view, queue.items);
+        for(auto i : scene.CollectVisible(view)) {
+            QueueObject(i, queue.items);
+        }
+        queue.Flush([](Object* obj) { obj->Draw(); });
     }
 
+    inline void SimulateFrame(Scene& scene, float delta_time) {
+        StepPhysics(scene, delta_time);
+        scene.updating=true;
+        DispatchSignals(scene);
+        UpdateObjects(scene, delta_time);
+        scene.updating=false;
+        scene.FlushCommands();
+    }
     inline void MainLoop() {
         while(!WindowShouldClose()) {
             BeginDrawing();
             {
-                ProfileTimer t("Update");
+                PROFILE_SCOPE("Frame");
                 BeginMode2D(Root::CurrentScene.camera);
                 ClearBackground(Root::CurrentScene.bgColor);
-                b2World_Step(Root::CurrentScene.worldID, GetFrameTime(), 4);
-                for(int i=signals.size()-1; i>=0; i--) {
-                    for(auto j : Root::CurrentScene.objects) {
-                        j->RecieveSignal(signals[i]);
+                SimulateFrame(Root::CurrentScene, GetFrameTime());
+                DrawObjects(Root::CurrentScene);
+            }
+            EndDrawing();
+            TextureCache::ReleasePending();
+            Stats::EndFrame();
+        }
+        Root::CurrentScene.Clear();
+        Root::CurrentScene.render->Unload();
+        TextureCache::ReleasePending();
+        CloseWindow();
+    }
+    // Runs the current scene without a window: no drawing, no frame cap, fixed delta_time per frame.
+    // Call InitPhysics() before building scenes. Objects are left alive afterwards so the caller can inspect the final state.
+    inline void RunHeadless(int frames, float delta_time) {
+        for(int f=0; f<frames; f++) {
+            SimulateFrame(Root::CurrentScene, delta_time);
+            TextureCache::ReleasePending();
+            Stats::EndFrame();
+        }
+    }
+
+    struct FrameSnapshot{
+        Camera2D camera;
+        Color bgColor;
+        std::vector<DrawItem> items;
+    };
+    class SimulationThread {
+        private:
+            std::mutex mtx;
+            std::condition_variable cv;
+            bool has_work=false;
+            bool running=true;
+            float delta_time=0;
+            std::thread thread;
+            void Loop() {
+                while(true) {
+                    float dt;
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [this] { return has_work || !running; });
+                        if(!running) return;
+                        dt=delta_time;
+                    }
+                    {
+                        PROFILE_SCOPE("Simulate");
+                        SimulateFrame(Root::CurrentScene, dt);
                     }
-                    signals.pop_back();
+                    {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        has_work=false;
+                    }
+                    cv.notify_all();
+                }
+            }
+        public:
+            SimulationThread() : thread(&SimulationThread::Loop, this) {}
+            ~SimulationThread() {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    running=false;
+                }
+                cv.notify_all();
+                thread.join();
+            }
+            void Start(float dt) {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    delta_time=dt;
+                    has_work=true;
                 }
-                for(int j=0; j<Root::CurrentScene.objects.size(); j++) {
-                    auto i=Root::CurrentScene.objects[j];
-                    i->UpdateComponents();
-                    i->Update(GetFrameTime());
-                    i->UpdateChildren();
-                    if(i->visible)
-                        i->Draw();
+                cv.notify_all();
+            }
+            void Wait() {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return !has_work; });
+            }
+    };
+    // Renders a snapshot of frame N on this thread while frame N+1 simulates on another.
+    // The sorted snapshot is drawn up to its last object that isn't batchable at the sync point, since Draw()
+    // reads the object, and the rest while the next frame simulates. Layers keep their order either way.
+    // Update() runs on the simulation thread, so it must not call raylib drawing or texture functions.
+    inline void PipelinedMainLoop() {
+        FrameSnapshot snapshot;
+        SimulationThread simulation;
+        while(!WindowShouldClose()) {
+            simulation.Wait();
+            // The last snapshot has been drawn and the simulation is idle, nothing refers to released textures
+            TextureCache::ReleasePending();
+            Stats::EndFrame();
+            Scene& scene=Root::CurrentScene;
+            BeginDrawing();
+            PROFILE_SCOPE("Frame");
+            ClearBackground(scene.bgColor);
+            snapshot.camera=scene.camera;
+            snapshot.bgColor=scene.bgColor;
+            snapshot.items.clear();
+            b2AABB view=ViewBounds(snapshot.camera);
+            if(scene.statics->Update(view)) scene.statics->Render(view);
+            BeginMode2D(snapshot.camera);
+            scene.statics->Queue(view, snapshot.items);
+            float& draw_time=Stats::current.draw;
+            size_t split;
+            {
+                Stats::Timer timer(draw_time);
+                for(auto i : scene.CollectVisible(view)) {
+                    QueueObject(i, snapshot.items);
                 }
+                scene.render->Prepare(snapshot.items);
+                split=scene.render->ObjectsEnd(snapshot.items);
+                scene.render->Execute(snapshot.items, 0, split, [](Object* obj) { obj->Draw(); });
+            }
+            simulation.Start(GetFrameTime());
+            {
+                Stats::Timer timer(draw_time);
+                scene.render->Execute(snapshot.items, split, snapshot.items.size(), [](Object*) {});
             }
+            EndMode2D();
             EndDrawing();
         }
-        for(auto i : Root::CurrentScene.objects) {
-            delete i;
-        }
+        simulation.Wait();
+        Root::CurrentScene.Clear();
+        Root::CurrentScene.render->Unload();
+        TextureCache::ReleasePending();
         CloseWindow();
     }
+    inline void InitPhysics() {
+        b2SetLengthUnitsPerMeter(10);
+    }
     inline void CreateWindow(const char* name, int screen_width, int screen_height) {
-        ProfileTimer t("Create Window");
+        PROFILE_SCOPE("Create Window");
         InitWindow(screen_width,screen_height,name);
         SetTargetFPS(60);
-        b2SetLengthUnitsPerMeter(10);
+        InitPhysics();
     }
 }
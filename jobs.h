@@ -0,0 +1,221 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "include/types.h"
+#include "profiler.h"
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Engine {
+    // Work-stealing thread pool. Worker 0 is the thread that owns the pool (the one calling
+    // b2World_Step); it runs jobs while it waits in Finish. Workers 1..count-1 are spawned threads.
+    class JobSystem {
+        private:
+            struct Task {
+                b2TaskCallback* fn=nullptr;
+                void* context=nullptr;
+                std::atomic<int> remaining{0};
+            };
+            struct Job {
+                Task* task;
+                int start;
+                int end;
+            };
+            struct Queue {
+                std::mutex mtx;
+                std::deque<Job> jobs;
+            };
+            int worker_count;
+            std::vector<std::unique_ptr<Queue>> queues;
+            std::vector<std::thread> threads;
+            std::vector<Task*> free_tasks;
+            std::mutex task_mtx;
+            std::mutex sleep_mtx;
+            std::condition_variable sleep_cv;
+            std::atomic<int> pending{0};
+            std::atomic<bool> running{true};
+            // Jobs executing right now and the most seen at once since the last PeakConcurrency()
+            std::atomic<int> active{0};
+            std::atomic<int> peak{0};
+            int next_queue=0;
+
+            bool Pop(int worker, Job& job) {
+                Queue& q=*queues[worker];
+                std::lock_guard<std::mutex> lock(q.mtx);
+                if(q.jobs.empty()) return false;
+                job=q.jobs.back();
+                q.jobs.pop_back();
+                pending--;
+                return true;
+            }
+            bool Steal(int worker, Job& job) {
+                for(int i=1; i<worker_count; i++) {
+                    Queue& q=*queues[(worker+i)%worker_count];
+                    std::lock_guard<std::mutex> lock(q.mtx);
+                    if(q.jobs.empty()) continue;
+                    job=q.jobs.front();
+                    q.jobs.pop_front();
+                    pending--;
+                    return true;
+                }
+                return false;
+            }
+            bool Next(int worker, Job& job) {
+                if(pending.load(std::memory_order_relaxed)<=0) return false;
+                return Pop(worker, job) || Steal(worker, job);
+            }
+            void Execute(const Job& job, int worker) {
+                PROFILE_SCOPE("Job");
+                int now=++active;
+                int seen=peak.load(std::memory_order_relaxed);
+                while(now>seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+                job.task->fn(job.start, job.end, worker, job.task->context);
+                active--;
+                job.task->remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            void Pin(int core) {
+#if defined(__linux__)
+                int cores=std::max(1u, std::thread::hardware_concurrency());
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(core%cores, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+            }
+            void WorkerLoop(int worker, bool pin) {
+                if(pin) Pin(worker);
+                Job job;
+                while(running) {
+                    // Spin briefly before sleeping, Box2D issues many short tasks back to back
+                    bool found=false;
+                    for(int spin=0; spin<2000 && running; spin++) {
+                        if(Next(worker, job)) {
+                            found=true;
+                            break;
+                        }
+                        std::this_thread::yield();
+                    }
+                    if(found) {
+                        Execute(job, worker);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(sleep_mtx);
+                    sleep_cv.wait(lock, [this] { return pending>0 || !running; });
+                }
+            }
+        public:
+            JobSystem(int workers, bool pin_threads=false) : worker_count(std::max(1, workers)) {
+                for(int i=0; i<worker_count; i++) {
+                    queues.emplace_back(new Queue);
+                }
+                for(int i=1; i<worker_count; i++) {
+                    threads.emplace_back(&JobSystem::WorkerLoop, this, i, pin_threads);
+                }
+            }
+            JobSystem(const JobSystem&)=delete;
+            ~JobSystem() {
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mtx);
+                    running=false;
+                }
+                sleep_cv.notify_all();
+                for(auto& i : threads) {
+                    i.join();
+                }
+                for(auto i : free_tasks) {
+                    delete i;
+                }
+            }
+            int WorkerCount()const{
+                return worker_count;
+            }
+            // Most jobs that ran at the same time since the last call, e.g. Box2D's per-worker solver
+            // tasks should reach the worker count when they overlap
+            int PeakConcurrency() {
+                return peak.exchange(active.load());
+            }
+            // Splits [0, item_count) into ranges of at least min_range and queues them.
+            // Single item tasks are queued too: Box2D starts one solver task per worker and they only
+            // run in parallel if none of them is run inline. Returns nullptr when the work ran inline.
+            void* Enqueue(b2TaskCallback* fn, int item_count, int min_range, void* context) {
+                min_range=std::max(1, min_range);
+                if(worker_count==1 || item_count<=0) {
+                    fn(0, item_count, 0, context);
+                    return nullptr;
+                }
+                int chunks=std::max(1, std::min(worker_count*4, item_count/min_range));
+                Task* task;
+                {
+                    std::lock_guard<std::mutex> lock(task_mtx);
+                    if(free_tasks.empty()) {
+                        task=new Task;
+                    } else {
+                        task=free_tasks.back();
+                        free_tasks.pop_back();
+                    }
+                }
+                task->fn=fn;
+                task->context=context;
+                task->remaining=chunks;
+                int start=0;
+                for(int i=0; i<chunks; i++) {
+                    int end=start+(item_count-start)/(chunks-i);
+                    Queue& q=*queues[next_queue];
+                    next_queue=(next_queue+1)%worker_count;
+                    {
+                        std::lock_guard<std::mutex> lock(q.mtx);
+                        q.jobs.push_back(Job{task, start, end});
+                    }
+                    pending++;
+                    start=end;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mtx);
+                }
+                sleep_cv.notify_all();
+                return task;
+            }
+            void Finish(void* user_task) {
+                Task* task=static_cast<Task*>(user_task);
+                Job job;
+                while(task->remaining.load(std::memory_order_acquire)>0) {
+                    if(Next(0, job)) {
+                        Execute(job, 0);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(task_mtx);
+                free_tasks.push_back(task);
+            }
+
+            // Runs fn(start, end, worker) over [0, count) on the pool and waits for it.
+            template<typename F> void ParallelFor(int count, int min_range, F& fn) {
+                if(count<=min_range) {
+                    fn(0, count, 0);
+                    return;
+                }
+                void* task=Enqueue(&Invoke<F>, count, min_range, &fn);
+                if(task!=nullptr) Finish(task);
+            }
+            template<typename F> static void Invoke(int start, int end, uint32_t worker, void* context) {
+                (*static_cast<F*>(context))(start, end, worker);
+            }
+
+            static void* EnqueueTask(b2TaskCallback* task, int item_count, int min_range, void* task_context, void* user_context) {
+                return static_cast<JobSystem*>(user_context)->Enqueue(task, item_count, min_range, task_context);
+            }
+            static void FinishTask(void* user_task, void* user_context) {
+                static_cast<JobSystem*>(user_context)->Finish(user_task);
+            }
+    };
+}
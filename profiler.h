@@ -0,0 +1,124 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Profiling is compiled out of release builds unless ENGINE_PROFILE is set explicitly.
+#ifndef ENGINE_PROFILE
+#ifdef NDEBUG
+#define ENGINE_PROFILE 0
+#else
+#define ENGINE_PROFILE 1
+#endif
+#endif
+
+#define ENGINE_PROFILE_CONCAT_(a, b) a##b
+#define ENGINE_PROFILE_CONCAT(a, b) ENGINE_PROFILE_CONCAT_(a, b)
+#if ENGINE_PROFILE
+#define PROFILE_SCOPE(name) Engine::ProfileTimer ENGINE_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+namespace Engine {
+    struct Profiler{
+        struct Zone{
+            const char* name;
+            uint64_t start;
+            uint64_t end;
+            uint32_t depth;
+        };
+        // Each thread writes only to its own ring buffer, oldest zones are overwritten once it's full.
+        struct ThreadBuffer{
+            std::unique_ptr<Zone[]> zones;
+            size_t capacity;
+            size_t count=0;
+            size_t head=0;
+            uint32_t depth=0;
+            uint32_t thread_id;
+            ThreadBuffer(size_t capacity, uint32_t id) : zones(new Zone[capacity]), capacity(capacity), thread_id(id) {}
+            void Push(const Zone& z) {
+                zones[head]=z;
+                head=(head+1)%capacity;
+                if(count<capacity) count++;
+            }
+        };
+        static size_t capacity;
+        static std::mutex mtx;
+        static std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        Profiler()=delete;
+
+        static uint64_t Now() {
+            static const auto epoch=std::chrono::steady_clock::now();
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+        }
+        static ThreadBuffer& Local() {
+            thread_local std::shared_ptr<ThreadBuffer> local;
+            if(local==nullptr) {
+                std::lock_guard<std::mutex> lock(mtx);
+                local=std::make_shared<ThreadBuffer>(capacity, uint32_t(buffers.size()));
+                buffers.push_back(local);
+            }
+            return *local;
+        }
+        static void Clear() {
+            std::lock_guard<std::mutex> lock(mtx);
+            for(auto& i : buffers) {
+                i->count=0;
+                i->head=0;
+            }
+        }
+        // Writes every recorded zone as Chrome trace-event JSON (chrome://tracing, Perfetto).
+        // Call it while no other thread is recording, e.g. after the main loop returns.
+        static bool WriteChromeTrace(const std::string& file_name) {
+            std::ofstream f(file_name.c_str());
+            if(!f) return false;
+            std::lock_guard<std::mutex> lock(mtx);
+            f<<std::fixed<<std::setprecision(3)<<"{\"traceEvents\":[";
+            bool first=true;
+            for(auto& b : buffers) {
+                size_t oldest=(b->head+b->capacity-b->count)%b->capacity;
+                for(size_t i=0; i<b->count; i++) {
+                    const Zone& z=b->zones[(oldest+i)%b->capacity];
+                    if(!first) f<<",";
+                    first=false;
+                    f<<"\n{\"name\":\""<<z.name<<"\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<b->thread_id
+                     <<",\"ts\":"<<z.start/1000.0<<",\"dur\":"<<(z.end-z.start)/1000.0
+                     <<",\"args\":{\"depth\":"<<z.depth<<"}}";
+                }
+            }
+            f<<"\n]}\n";
+            return true;
+        }
+    };
+    size_t Profiler::capacity=1<<16;
+    std::mutex Profiler::mtx;
+    std::vector<std::shared_ptr<Profiler::ThreadBuffer>> Profiler::buffers;
+
+#if ENGINE_PROFILE
+    // Scoped zone: records its begin/end timestamps and nesting depth in the calling thread's buffer.
+    struct ProfileTimer{
+        const char* name;
+        uint64_t start;
+        Profiler::ThreadBuffer& buffer;
+        ProfileTimer(const char* name) : name(name), buffer(Profiler::Local()) {
+            buffer.depth++;
+            start=Profiler::Now();
+        }
+        ~ProfileTimer() {
+            uint64_t end=Profiler::Now();
+            buffer.depth--;
+            buffer.Push(Profiler::Zone{name, start, end, buffer.depth});
+        }
+    };
+#else
+    struct ProfileTimer{
+        ProfileTimer(const char* name) {}
+    };
+#endif
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "raylib.h"
+#include "rlgl.h"
+#include "profiler.h"
+
+namespace Engine {
+    class Object;
+    // The source part of texture (in pixels) drawn to rect, rotated in degrees around rect's top left corner.
+    // Items with an object draw it through Object::Draw() instead.
+    struct DrawItem{
+        Texture2D texture;
+        Rectangle source;
+        Rectangle rect;
+        float rotation;
+        Color tint;
+        uint64_t key=0;
+        // id 0 draws with raylib's default shader
+        Shader shader={0, nullptr};
+        int blend=BLEND_ALPHA;
+        Object* object=nullptr;
+    };
+    // Collects the frame's draws, sorts them once by their key and executes them, so layers and depth are
+    // respected and each shader, blend mode and texture is set as few times as the ordering allows.
+    // Quads are emitted through rlgl, which puts consecutive ones sharing a texture in a single draw call.
+    class RenderQueue {
+        private:
+            static constexpr int batch_elements=16384;
+            static constexpr int chunk=1024;
+            struct Sortable {
+                uint64_t key;
+                uint32_t index;
+            };
+            rlRenderBatch batch;
+            bool loaded=false;
+            std::vector<Sortable> order;
+            std::vector<Sortable> scratch;
+            // LSD radix sort, 8 bits per pass. Stable, so equal keys keep their submission order.
+            void Sort(const std::vector<DrawItem>& list) {
+                order.resize(list.size());
+                scratch.resize(list.size());
+                for(uint32_t i=0; i<list.size(); i++) {
+                    order[i]=Sortable{list[i].key, i};
+                }
+                for(int shift=0; shift<64; shift+=8) {
+                    size_t counts[256]={};
+                    for(auto& i : order) {
+                        counts[(i.key>>shift)&0xff]++;
+                    }
+                    // Every key has the same byte here, nothing to move
+                    if(counts[(order[0].key>>shift)&0xff]==order.size()) continue;
+                    size_t offset=0;
+                    for(auto& c : counts) {
+                        size_t n=c;
+                        c=offset;
+                        offset+=n;
+                    }
+                    for(auto& i : order) {
+                        scratch[counts[(i.key>>shift)&0xff]++]=i;
+                    }
+                    std::swap(order, scratch);
+                }
+            }
+        public:
+            std::vector<DrawItem> items;
+            // Mode that BLEND_ALPHA items and objects are drawn with, e.g. a separate alpha factor when
+            // rendering into a transparent target
+            int alpha_blend=BLEND_ALPHA;
+            RenderQueue()=default;
+            RenderQueue(const RenderQueue&)=delete;
+
+            // Draws sort before any later layer, then by depth (higher on top), shader, texture and blend mode
+            static uint64_t Key(uint8_t layer, int16_t depth, unsigned int shader, unsigned int texture, int blend) {
+                return uint64_t(layer)<<56 | uint64_t(uint16_t(depth+32768))<<40 | uint64_t(shader&0xfff)<<28
+                    | uint64_t(texture&0xffffff)<<4 | uint64_t(blend&0xf);
+            }
+            // Executes and clears items. draw_object(Object*) is called for items that carry an object.
+            template<typename F> void Flush(F draw_object) {
+                Submit(items, draw_object);
+                items.clear();
+            }
+            void Submit(const std::vector<DrawItem>& list) {
+                Submit(list, [](Object*) {});
+            }
+            // Sorts list by key and draws it with the current 2D mode
+            template<typename F> void Submit(const std::vector<DrawItem>& list, F draw_object) {
+                Prepare(list);
+                Execute(list, 0, list.size(), draw_object);
+            }
+            // Sorts list for Execute, which can then draw it in several parts
+            void Prepare(const std::vector<DrawItem>& list) {
+                order.clear();
+                if(!list.empty()) Sort(list);
+            }
+            // Sorted position just past the last item that carries an object, 0 if there is none
+            size_t ObjectsEnd(const std::vector<DrawItem>& list)const{
+                for(size_t i=order.size(); i>0; i--) {
+                    if(list[order[i-1].index].object!=nullptr) return i;
+                }
+                return 0;
+            }
+            // Draws the prepared list's items from sorted position begin up to end
+            template<typename F> void Execute(const std::vector<DrawItem>& list, size_t begin, size_t end, F draw_object) {
+                PROFILE_SCOPE("Render Queue");
+                if(begin>=end) return;
+                // The default rlgl batch holds 8192 quads, a larger one of our own flushes less often
+                if(!loaded) {
+                    batch=rlLoadRenderBatch(1, batch_elements);
+                    loaded=true;
+                }
+                rlSetRenderBatchActive(&batch);
+                unsigned int shader=0;
+                int blend=BLEND_ALPHA;
+                unsigned int texture=0;
+                int run=0;
+                bool open=false;
+                auto close=[&] {
+                    if(open) rlEnd();
+                    open=false;
+                };
+                auto reset=[&] {
+                    close();
+                    if(shader!=0) EndShaderMode();
+                    if(blend!=BLEND_ALPHA) EndBlendMode();
+                    shader=0;
+                    blend=BLEND_ALPHA;
+                };
+                for(size_t i=begin; i<end; i++) {
+                    const DrawItem& d=list[order[i].index];
+                    if(d.object!=nullptr) {
+                        reset();
+                        rlSetTexture(0);
+                        if(alpha_blend!=BLEND_ALPHA) BeginBlendMode(alpha_blend);
+                        draw_object(d.object);
+                        if(alpha_blend!=BLEND_ALPHA) EndBlendMode();
+                        continue;
+                    }
+                    if(d.shader.id!=shader) {
+                        close();
+                        if(d.shader.id==0)
+                            EndShaderMode();
+                        else
+                            BeginShaderMode(d.shader);
+                        shader=d.shader.id;
+                    }
+                    int item_blend=d.blend==BLEND_ALPHA ? alpha_blend : d.blend;
+                    if(item_blend!=blend) {
+                        close();
+                        BeginBlendMode(item_blend);
+                        blend=item_blend;
+                    }
+                    if(d.texture.id!=texture || run==chunk) close();
+                    if(!open) {
+                        rlCheckRenderBatchLimit(chunk*4);
+                        texture=d.texture.id;
+                        rlSetTexture(texture);
+                        rlBegin(RL_QUADS);
+                        rlNormal3f(0, 0, 1);
+                        open=true;
+                        run=0;
+                    }
+                    Quad(d);
+                    run++;
+                }
+                reset();
+                rlSetTexture(0);
+                rlSetRenderBatchActive(nullptr);
+            }
+            // Must run while the GL context still exists, e.g. before CloseWindow
+            void Unload() {
+                if(!loaded) return;
+                rlUnloadRenderBatch(batch);
+                loaded=false;
+            }
+        private:
+            // Same corner order and UVs as DrawTexturePro
+            static void Quad(const DrawItem& d) {
+                float u0=d.source.x/d.texture.width;
+                float v0=d.source.y/d.texture.height;
+                float u1=(d.source.x+d.source.width)/d.texture.width;
+                float v1=(d.source.y+d.source.height)/d.texture.height;
+                float rad=d.rotation*DEG2RAD;
+                float cs=std::cos(rad);
+                float sn=std::sin(rad);
+                float x=d.rect.x;
+                float y=d.rect.y;
+                float wx=d.rect.width*cs;
+                float wy=d.rect.width*sn;
+                float hx=-d.rect.height*sn;
+                float hy=d.rect.height*cs;
+                rlColor4ub(d.tint.r, d.tint.g, d.tint.b, d.tint.a);
+                rlTexCoord2f(u0, v0);
+                rlVertex2f(x, y);
+                rlTexCoord2f(u0, v1);
+                rlVertex2f(x+hx, y+hy);
+                rlTexCoord2f(u1, v1);
+                rlVertex2f(x+wx+hx, y+wy+hy);
+                rlTexCoord2f(u1, v0);
+                rlVertex2f(x+wx, y+wy);
+            }
+    };
+}
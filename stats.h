@@ -0,0 +1,97 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "include/box2d.h"
+#include "include/types.h"
+
+namespace Engine {
+    struct Stats{
+        // Engine timings are in milliseconds, b2Profile is summed over every physics step in the frame
+        struct Frame{
+            b2Profile profile={};
+            b2Counters counters={};
+            int steps=0;
+            // Most jobs running at once during the frame's steps, below the worker count means the solver ran serially
+            int parallel_jobs=0;
+            float physics=0;
+            float signals=0;
+            float update=0;
+            float draw=0;
+            float frame=0;
+        };
+        struct Summary{
+            float min=0;
+            float mean=0;
+            float p99=0;
+        };
+        struct Timer{
+            float& target;
+            std::chrono::steady_clock::time_point start;
+            Timer(float& target) : target(target), start(std::chrono::steady_clock::now()) {}
+            ~Timer() {
+                target+=std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now()-start).count();
+            }
+        };
+        static size_t window;
+        static std::vector<Frame> frames;
+        static size_t next;
+        static Frame current;
+        static std::chrono::steady_clock::time_point frame_start;
+        Stats()=delete;
+
+        static void AddStep(b2WorldId world) {
+            static_assert(sizeof(b2Profile)%sizeof(float)==0, "b2Profile is expected to only hold floats");
+            b2Profile p=b2World_GetProfile(world);
+            float* sum=reinterpret_cast<float*>(&current.profile);
+            const float* step=reinterpret_cast<const float*>(&p);
+            for(size_t i=0; i<sizeof(b2Profile)/sizeof(float); i++) {
+                sum[i]+=step[i];
+            }
+            current.counters=b2World_GetCounters(world);
+            current.steps++;
+        }
+        static void EndFrame() {
+            auto now=std::chrono::steady_clock::now();
+            current.frame=std::chrono::duration<float, std::milli>(now-frame_start).count();
+            frame_start=now;
+            if(frames.size()<window) {
+                frames.push_back(current);
+            } else {
+                frames[next]=current;
+            }
+            next=(next+1)%window;
+            current=Frame();
+        }
+        // The most recently completed frame
+        static const Frame& Last() {
+            if(frames.empty()) return current;
+            return frames[(next+frames.size()-1)%frames.size()];
+        }
+        // field is anything invocable on a Frame, e.g. &Stats::Frame::update or [](auto& f) { return f.profile.solve; }
+        template<typename F> static Summary Summarize(F field) {
+            Summary s;
+            if(frames.empty()) return s;
+            std::vector<float> values;
+            values.reserve(frames.size());
+            for(auto& i : frames) {
+                values.push_back(float(std::invoke(field, i)));
+            }
+            std::sort(values.begin(), values.end());
+            s.min=values.front();
+            float total=0;
+            for(auto i : values) {
+                total+=i;
+            }
+            s.mean=total/values.size();
+            s.p99=values[std::min(values.size()-1, size_t(values.size()*0.99))];
+            return s;
+        }
+    };
+    size_t Stats::window=300;
+    std::vector<Stats::Frame> Stats::frames;
+    size_t Stats::next=0;
+    Stats::Frame Stats::current;
+    std::chrono::steady_clock::time_point Stats::frame_start=std::chrono::steady_clock::now();
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "raylib.h"
+#include "atlas.h"
+
+namespace Engine {
+    // One CPU image and its GPU texture, shared by every ImageTexture made from the same source.
+    // Released when the last reference goes away, along with its entries in the atlases it was packed into.
+    // That can happen on any thread, the unloading itself waits for TextureCache::ReleasePending().
+    struct TextureResource{
+        std::string key;
+        Image image;
+        Texture2D texture;
+        bool texture_loaded=false;
+        // Entry in each atlas the image was packed into, so copies don't insert it again
+        std::vector<std::pair<TextureAtlas*, int>> atlas_entries;
+        TextureResource(const std::string& key, Image image) : key(key), image(image) {}
+        TextureResource(const TextureResource&)=delete;
+        ~TextureResource();
+        Texture2D& GetTexture() {
+            if(!texture_loaded) {
+                texture=LoadTextureFromImage(image);
+                texture_loaded=true;
+            }
+            return texture;
+        }
+        int AtlasEntry(TextureAtlas& atlas) {
+            for(auto& i : atlas_entries) {
+                if(i.first==&atlas) return i.second;
+            }
+            int id=atlas.Insert(image);
+            atlas_entries.emplace_back(&atlas, id);
+            return id;
+        }
+    };
+    struct TextureCache{
+        static std::mutex mtx;
+        static std::unordered_map<std::string, std::weak_ptr<TextureResource>> entries;
+        // Key used by the magenta placeholder that default ImageTextures share
+        static const char* default_key;
+        struct Released{
+            Image image;
+            Texture2D texture;
+            bool texture_loaded;
+            std::vector<std::pair<TextureAtlas*, int>> atlas_entries;
+        };
+        // Resources whose last reference went away since the last ReleasePending()
+        static std::vector<Released> pending;
+        TextureCache()=delete;
+
+        static std::shared_ptr<TextureResource> Load(const std::string& path) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if(auto cached=entries[path].lock()) return cached;
+            Image image=path==default_key ? GenImageColor(60, 60, MAGENTA) : LoadImage(path.c_str());
+            auto r=std::make_shared<TextureResource>(path, image);
+            entries[path]=r;
+            return r;
+        }
+        static std::shared_ptr<TextureResource> Default() {
+            return Load(default_key);
+        }
+        // Wraps an image that has no path, it isn't shared through the cache and is unloaded with the resource
+        static std::shared_ptr<TextureResource> Adopt(Image image) {
+            return std::make_shared<TextureResource>(std::string(), image);
+        }
+        static std::shared_ptr<TextureResource> Adopt(Texture2D texture) {
+            auto r=Adopt(LoadImageFromTexture(texture));
+            r->texture=texture;
+            r->texture_loaded=true;
+            return r;
+        }
+        // Unloads the released resources. Must run on the thread that owns the GL context, at a point where
+        // nothing queued for drawing can still refer to them.
+        static void ReleasePending() {
+            std::vector<Released> list;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if(pending.empty()) return;
+                std::swap(list, pending);
+            }
+            for(auto& r : list) {
+                for(auto& i : r.atlas_entries) {
+                    i.first->Remove(i.second);
+                }
+                if(r.texture_loaded) UnloadTexture(r.texture);
+                UnloadImage(r.image);
+            }
+        }
+        static size_t Size() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return entries.size();
+        }
+    };
+    std::mutex TextureCache::mtx;
+    std::unordered_map<std::string, std::weak_ptr<TextureResource>> TextureCache::entries;
+    const char* TextureCache::default_key="#default";
+    std::vector<TextureCache::Released> TextureCache::pending;
+
+    inline TextureResource::~TextureResource() {
+        std::lock_guard<std::mutex> lock(TextureCache::mtx);
+        if(!key.empty()) {
+            auto it=TextureCache::entries.find(key);
+            if(it!=TextureCache::entries.end() && it->second.expired())
+                TextureCache::entries.erase(it);
+        }
+        TextureCache::pending.push_back({image, texture, texture_loaded, std::move(atlas_entries)});
+    }
+}